@@ -7,8 +7,11 @@
 
 #include "util.h"
 #include "mmu.h"
-
-address_space root_as;
+#include "machine.h"
+#include "regfile.h"
+#include "stats.h"
+#include "flight.h"
+#include "probes.h"
 
 
 static uint64_t
@@ -50,6 +53,20 @@ register_address_space(address_space *parent, address_space *child)
     parent->children = child;
 }
 
+/* The child of @as that holds @addr, NULL if none */
+static inline address_space *
+_child(address_space *as, uint64_t addr)
+{
+    address_space *child;
+
+    for (child = as->children; child; child = child->sibling) {
+        if (addr >= child->start && addr <= child->end)
+            return child;
+    }
+
+    return NULL;
+}
+
 uint64_t
 as_read_nommu(address_space *as, uint64_t addr, size_t size, params_t params)
 {
@@ -59,24 +76,48 @@ as_read_nommu(address_space *as, uint64_t addr, size_t size, params_t params)
         panic("%s: bad size %d\n", __func__, size);
 
     if (as == NULL)
-        as = &root_as;
-
-    child = as->children;
-    while (child) {
-        if (addr >= child->start && addr <= child->end)
-            return as_read_nommu(child, addr - child->start, size, params);
+        as = &_machine->root_as;
 
-        child = child->sibling;
-    }
+    child = _child(as, addr);
+    if (child)
+        return as_read_nommu(child, addr - child->start, size, params);
 
     return as->ops.read_op(as->device, addr, size, params);
 }
 
+/*
+ * Guest access to a device: flight recorder and per device counts.
+ * Returns the device's address space, the caller dispatches to it
+ * without a second walk.
+ */
+static address_space *
+_mmio_access(address_space *as, uint64_t paddr, size_t size, uint64_t data,
+             bool write)
+{
+    address_space *child;
+
+    flight_log(write ? FLIGHT_MMIO_WRITE : FLIGHT_MMIO_READ,
+               _pc, 0, paddr, data)->size = (uint8_t)size;
+
+    child = _child(as, paddr);
+    if (child == NULL)
+        return NULL;
+
+    if (write)
+        ((device_t *) child->device)->mmio_writes++;
+    else
+        ((device_t *) child->device)->mmio_reads++;
+
+    return child;
+}
+
 uint64_t
 as_read(address_space *as, uint64_t vaddr, size_t size, params_t params,
      bool *has_except)
 {
     uint64_t paddr;
+    uint64_t data;
+    address_space *child;
 
     if (mmu(as, vaddr, &paddr) < 0) {
         if (has_except)
@@ -84,7 +125,20 @@ as_read(address_space *as, uint64_t vaddr, size_t size, params_t params,
         return 0;
     }
 
-    return as_read_nommu(as, paddr, size, params);
+    as_last_paddr = paddr;
+    if (!is_mmio(paddr))
+        return as_read_nommu(as, paddr, size, params);
+
+    if (as == NULL)
+        as = &_machine->root_as;
+
+    child = _mmio_access(as, paddr, size, 0, false);
+    if (child)
+        data = as_read_nommu(child, paddr - child->start, size, params);
+    else
+        data = as_read_nommu(as, paddr, size, params);
+    PROBE3(mmio_read, paddr, size, data);
+    return data;
 }
 
 uint64_t
@@ -97,17 +151,11 @@ as_write_nommu(address_space *as, uint64_t addr, size_t size, uint64_t data,
         panic("%s: bad size %d\n", __func__, size);
 
     if (as == NULL)
-        as = &root_as;
-
-    child = as->children;
-    while (child) {
-        if (addr >= child->start && addr <= child->end) {
-            return as_write_nommu(child, addr - child->start, size, data,
-                               params);
-        }
+        as = &_machine->root_as;
 
-        child = child->sibling;
-    }
+    child = _child(as, addr);
+    if (child)
+        return as_write_nommu(child, addr - child->start, size, data, params);
 
     return as->ops.write_op(as->device, addr, data, size, params);
 }
@@ -117,6 +165,7 @@ as_write(address_space *as, uint64_t vaddr, size_t size, uint64_t data,
       params_t params, bool *has_except)
 {
     uint64_t paddr;
+    address_space *child;
 
     if (mmu(as, vaddr, &paddr) < 0) {
         if (has_except)
@@ -124,6 +173,19 @@ as_write(address_space *as, uint64_t vaddr, size_t size, uint64_t data,
         return 0;
     }
 
+    as_last_paddr = paddr;
+    if (!is_mmio(paddr))
+        return as_write_nommu(as, paddr, size, data, params);
+
+    if (as == NULL)
+        as = &_machine->root_as;
+
+    PROBE3(mmio_write, paddr, size, data);
+    child = _mmio_access(as, paddr, size, data, true);
+    if (child)
+        return as_write_nommu(child, paddr - child->start, size, data,
+                              params);
+
     return as_write_nommu(as, paddr, size, data, params);
 }
 
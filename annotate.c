@@ -0,0 +1,147 @@
+/*
+ * Annotate
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "annotate.h"
+#include "list.h"
+#include "util.h"
+#include "regfile.h"
+#include "request.h"
+#include "snapshot.h"
+
+typedef struct _hook_t {
+    list_head       entry;
+    annotate_hook   fn;
+    void            *opaque;
+} hook_t;
+
+__thread bool annotate_roi;
+
+static __thread list_head hooks;
+
+/* Built-in counters, summed over regions since the last reset */
+static __thread uint64_t roi_id;
+static __thread uint64_t roi_start_insns;
+static __thread uint64_t roi_start_ns;
+static __thread uint64_t roi_insns;
+static __thread uint64_t roi_ns;
+
+static __thread uint32_t checkpoint_req;
+static __thread char checkpoint_name[64];
+
+/* Between two instructions, so the pc saved is past the csr write */
+static void
+_checkpoint_request(void *opaque)
+{
+    if (snapshot_save(checkpoint_name) == 0)
+        fprintf(stderr, "annotate: checkpoint %s\n", checkpoint_name);
+}
+
+void
+annotate_init(void)
+{
+    INIT_LIST_HEAD(&hooks);
+
+    annotate_roi = false;
+    roi_insns = 0;
+    roi_ns = 0;
+
+    checkpoint_req = request_register(_checkpoint_request, NULL);
+}
+
+void
+annotate_exit(void)
+{
+    while (!list_empty(&hooks)) {
+        hook_t *hook = list_first_entry(&hooks, hook_t, entry);
+        list_del(&(hook->entry));
+        free(hook);
+    }
+}
+
+void
+annotate_register(annotate_hook fn, void *opaque)
+{
+    hook_t *hook = calloc(1, sizeof(hook_t));
+
+    hook->fn = fn;
+    hook->opaque = opaque;
+    list_add_tail(&(hook->entry), &hooks);
+}
+
+static void
+_dump_stats(void)
+{
+    double secs = (double)roi_ns / 1e9;
+
+    fprintf(stderr, "annotate: roi %lu insns in %.3fs, %.2f MIPS\n",
+            roi_insns, secs, secs > 0 ? (double)roi_insns / secs / 1e6 : 0.0);
+}
+
+void
+annotate_command(uint64_t val)
+{
+    hook_t *hook;
+    uint64_t arg = reg[REG_A1];
+    annotate_cmd cmd = (annotate_cmd) val;
+
+    switch (cmd)
+    {
+    case ANNOTATE_NOP:
+        break;
+    case ANNOTATE_ROI_BEGIN:
+        if (annotate_roi)
+            break;
+
+        annotate_roi = true;
+        roi_id = arg;
+        roi_start_insns = _insn_count;
+        roi_start_ns = (uint64_t)get_clock();
+        break;
+    case ANNOTATE_ROI_END:
+        if (!annotate_roi)
+            break;
+
+        annotate_roi = false;
+        roi_insns += _insn_count - roi_start_insns;
+        roi_ns += (uint64_t)get_clock() - roi_start_ns;
+        fprintf(stderr, "annotate: roi %lu end\n", roi_id);
+        break;
+    case ANNOTATE_CHECKPOINT:
+        snprintf(checkpoint_name, sizeof(checkpoint_name),
+                 "checkpoint-%lu.snap", arg);
+        request_post(checkpoint_req);
+        break;
+    case ANNOTATE_RESET_STATS:
+        roi_insns = 0;
+        roi_ns = 0;
+        break;
+    case ANNOTATE_DUMP_STATS:
+        _dump_stats();
+        break;
+    case ANNOTATE_PRINT:
+        annotate_print(_pc, arg);
+        break;
+    default:
+        fprintf(stderr, "annotate: unknown command %lu\n", val);
+        return;
+    }
+
+    list_for_each_entry(hook, &hooks, entry)
+        hook->fn(cmd, arg, hook->opaque);
+}
+
+uint64_t
+annotate_read(void)
+{
+    return annotate_roi;
+}
+
+void
+annotate_print(uint64_t pc, uint64_t val)
+{
+    fprintf(stderr, "#DEBUG:[%lx]: %lx\n", pc, val);
+}
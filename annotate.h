@@ -0,0 +1,61 @@
+/*
+ * Annotate
+ *
+ * Guest to host markers, in the manner of gem5's m5ops. The guest
+ * writes a command to CSR XANNOTATE, with its argument in a1:
+ *
+ *      li      a1, 1
+ *      li      a0, ANNOTATE_ROI_BEGIN
+ *      csrw    0x8c0, a0
+ *
+ * Reading the CSR gives 1 inside a region of interest, 0 outside.
+ * Host modules hook the commands to switch on detailed tracing,
+ * profiling or counters only between ROI markers.
+ */
+
+#ifndef _ANNOTATE_H_
+#define _ANNOTATE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define XANNOTATE   0x8c0   /* Custom read/write CSR */
+
+typedef enum {
+    ANNOTATE_NOP = 0,
+    ANNOTATE_ROI_BEGIN,     /* a1: region id */
+    ANNOTATE_ROI_END,
+    ANNOTATE_CHECKPOINT,    /* Snapshot to checkpoint-<a1>.snap */
+    ANNOTATE_RESET_STATS,
+    ANNOTATE_DUMP_STATS,
+    ANNOTATE_PRINT,         /* Print a1 */
+} annotate_cmd;
+
+typedef void (*annotate_hook)(annotate_cmd cmd, uint64_t arg, void *opaque);
+
+/* Inside a region of interest */
+extern __thread bool annotate_roi;
+
+void
+annotate_init(void);
+
+/* Drop the hooks of the machine on this thread */
+void
+annotate_exit(void);
+
+/* Called for every command, after the built-in handling */
+void
+annotate_register(annotate_hook hook, void *opaque);
+
+/* Guest wrote @val to XANNOTATE, on the cpu thread */
+void
+annotate_command(uint64_t val);
+
+uint64_t
+annotate_read(void);
+
+/* Debug print of writes to CSR 0 */
+void
+annotate_print(uint64_t pc, uint64_t val);
+
+#endif /* _ANNOTATE_H_ */
@@ -0,0 +1,212 @@
+/*
+ * Batch runner
+ *
+ * Runs many guests on a pool of threads, one machine per thread at a
+ * time. Every kernel on the command line is a job, booted directly
+ * with the same firmware; rom and flash images are read once and
+ * shared by all guests. Results come out as one line per job.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "util.h"
+#include "machine.h"
+#include "regfile.h"
+
+#define DEFAULT_MAX_INSNS   10000000UL
+#define DEFAULT_MEM_SIZE    0x4000000UL     /* 64M */
+
+typedef struct _job_t {
+    const char  *kernel;
+    uint32_t    round;
+
+    char        console[256];
+
+    machine_exit_t reason;
+    uint32_t    code;
+    uint64_t    insns;
+    uint64_t    pc;
+    uint64_t    a0;
+    uint64_t    ns;
+} job_t;
+
+static machine_config config;
+static uint64_t max_insns = DEFAULT_MAX_INSNS;
+static const char *out_dir;
+
+static job_t *jobs;
+static uint32_t nr_jobs;
+static uint32_t next_job;
+
+enum {
+    OPT_FIRMWARE = 0x100,
+    OPT_KERNEL_ADDR,
+};
+
+static const struct option long_options[] = {
+    {"jobs",        required_argument, NULL, 'j'},
+    {"max-insns",   required_argument, NULL, 'n'},
+    {"memory",      required_argument, NULL, 'm'},
+    {"repeat",      required_argument, NULL, 'r'},
+    {"output",      required_argument, NULL, 'o'},
+    {"firmware",    required_argument, NULL, OPT_FIRMWARE},
+    {"kernel-addr", required_argument, NULL, OPT_KERNEL_ADDR},
+    {"help",        no_argument,       NULL, 'h'},
+    {NULL, 0, NULL, 0}
+};
+
+static void
+usage(const char *name)
+{
+    printf("Usage: %s [options] kernel...\n"
+           "  -j, --jobs N           guests running at once\n"
+           "                         (default: number of cpus)\n"
+           "  -n, --max-insns N      stop a guest after N instructions\n"
+           "                         (default: %lu)\n"
+           "  -m, --memory SIZE      guest ram size (default: 64M)\n"
+           "  -r, --repeat N         run every kernel N times\n"
+           "  -o, --output DIR       write job consoles to DIR/job-N.log\n"
+           "                         (default: discard them)\n"
+           "  --firmware FILE|none   firmware for every job\n"
+           "                         (default: image/fw_jump.bin)\n"
+           "  --kernel-addr ADDR     load address of flat kernels\n"
+           "  -h, --help             show this message\n",
+           name, DEFAULT_MAX_INSNS);
+}
+
+static void
+run_job(job_t *job)
+{
+    machine_t *m;
+    int64_t start;
+    machine_config cfg = config;
+
+    cfg.kernel = job->kernel;
+    cfg.console = job->console;
+
+    start = get_clock();
+
+    m = machine_create(&cfg);
+    job->insns = machine_run(m, max_insns);
+    job->reason = m->exit_reason;
+    job->code = m->exit_code;
+    job->pc = machine_get_pc(m);
+    job->a0 = machine_get_reg(m, REG_A0);
+    machine_destroy(m);
+
+    job->ns = (uint64_t)(get_clock() - start);
+}
+
+static void *
+worker(void *opaque)
+{
+    uint32_t i;
+
+    while ((i = __atomic_fetch_add(&next_job, 1, __ATOMIC_RELAXED)) < nr_jobs)
+        run_job(&jobs[i]);
+
+    return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+    int c;
+    uint32_t i;
+    uint32_t nr_threads;
+    uint32_t repeat = 1;
+    uint32_t nr_kernels;
+    pthread_t *tids;
+
+    machine_config_init(&config);
+    config.mem_size = DEFAULT_MEM_SIZE;
+    config.direct_boot = true;
+
+    nr_threads = (uint32_t)sysconf(_SC_NPROCESSORS_ONLN);
+
+    while ((c = getopt_long(argc, argv, "j:n:m:r:o:h",
+                            long_options, NULL)) != -1) {
+        switch (c)
+        {
+        case 'j':
+            nr_threads = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            max_insns = strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            config.mem_size = parse_size(optarg);
+            break;
+        case 'r':
+            repeat = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'o':
+            out_dir = optarg;
+            break;
+        case OPT_FIRMWARE:
+            config.firmware = streq(optarg, "none") ? NULL : optarg;
+            break;
+        case OPT_KERNEL_ADDR:
+            config.kernel_addr = strtoul(optarg, NULL, 0);
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(0);
+        default:
+            usage(argv[0]);
+            exit(-1);
+        }
+    }
+
+    nr_kernels = (uint32_t)(argc - optind);
+    if (!nr_kernels || !nr_threads || !repeat) {
+        usage(argv[0]);
+        exit(-1);
+    }
+
+    nr_jobs = nr_kernels * repeat;
+    jobs = calloc(nr_jobs, sizeof(job_t));
+    for (i = 0; i < nr_jobs; i++) {
+        job_t *job = &jobs[i];
+
+        job->kernel = argv[(uint32_t)optind + i % nr_kernels];
+        job->round = i / nr_kernels;
+
+        if (out_dir)
+            snprintf(job->console, sizeof(job->console),
+                     "%s/job-%u.log", out_dir, i);
+        else
+            strcpy(job->console, "/dev/null");
+    }
+
+    if (nr_threads > nr_jobs)
+        nr_threads = nr_jobs;
+
+    tids = calloc(nr_threads, sizeof(pthread_t));
+    for (i = 0; i < nr_threads; i++) {
+        if (pthread_create(&tids[i], NULL, worker, NULL))
+            panic("%s: cannot create worker\n", __func__);
+    }
+
+    for (i = 0; i < nr_threads; i++)
+        pthread_join(tids[i], NULL);
+
+    printf("job\tkernel\tround\texit\tcode\tinsns\tpc\ta0\tms\tconsole\n");
+    for (i = 0; i < nr_jobs; i++) {
+        job_t *job = &jobs[i];
+
+        printf("%u\t%s\t%u\t%s\t%u\t%lu\t0x%lx\t0x%lx\t%lu\t%s\n",
+               i, job->kernel, job->round, machine_exit_name(job->reason),
+               job->code, job->insns, job->pc, job->a0,
+               job->ns / 1000000, job->console);
+    }
+
+    free(tids);
+    free(jobs);
+    return 0;
+}
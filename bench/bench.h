@@ -0,0 +1,62 @@
+#ifndef _XEMU_BENCH_H_
+#define _XEMU_BENCH_H_
+
+/*
+ * Bare payloads, entered in M-mode at the kernel link address with
+ * --firmware none. They report counters on the console as
+ * "bench <name> <value>" lines and end through the test finisher.
+ */
+
+#define BENCH_LINK_ADDR     0x80200000
+#define BENCH_STACK_TOP     0x80300000
+
+/* Scratch ram, the payloads run with -m 64M */
+#define BENCH_BUF_0         0x80400000
+#define BENCH_BUF_1         0x80800000
+#define BENCH_BUF_2         0x81000000
+
+#define TEST_BASE           0x100000
+#define TEST_PASS           0x5555
+#define TEST_FAIL           0x3333
+
+#define UART_BASE           0x10000000
+#define UART_LSR            5
+#define UART_SCR            7
+#define UART_LSR_THRE       0x20
+
+#define VIRTIO_BASE         0x10001000
+
+/* See annotate.h */
+#define XANNOTATE           0x8c0
+#define ANNOTATE_ROI_BEGIN  1
+#define ANNOTATE_ROI_END    2
+
+#ifdef __ASSEMBLY__
+
+/* Region of interest for --stats, --heatmap and the profiler */
+.macro roi_begin id
+    li      a0, ANNOTATE_ROI_BEGIN
+    li      a1, \id
+    csrw    XANNOTATE, a0
+.endm
+
+.macro roi_end id
+    li      a0, ANNOTATE_ROI_END
+    li      a1, \id
+    csrw    XANNOTATE, a0
+.endm
+
+/* Print "bench <name> <reg>", clobbers the caller saved registers */
+.macro counter name, reg
+    mv      a1, \reg
+    la      a0, 9f
+    call    put_counter
+    j       8f
+9:  .asciz  "\name"
+    .balign 4, 0
+8:
+.endm
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* _XEMU_BENCH_H_ */
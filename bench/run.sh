@@ -0,0 +1,44 @@
+#!/bin/sh
+#
+# Run every bench payload headless and print one tab separated line
+# per benchmark: name, exit, instructions, seconds, MIPS and the
+# counters the payload reported, as name=value pairs.
+#
+# Run from the top of the tree, xemu needs ./image for its symbols.
+#
+
+BENCH=$(dirname "$0")
+XEMU=${XEMU:-./xemu}
+TIMEOUT=${TIMEOUT:-120}
+LOG=$(mktemp -d)
+
+trap 'rm -rf "$LOG"' EXIT
+
+printf "bench\texit\tinsns\tsecs\tmips\tcounters\n"
+
+status=0
+for bin in "$BENCH"/*.bin; do
+    name=$(basename "$bin" .bin)
+
+    $XEMU -m 64M --headless --firmware none --kernel "$bin" \
+          --drive "$BENCH/disk.raw" --timeout "$TIMEOUT" \
+          --console "$LOG/$name.out" $BENCH_ARGS \
+          > /dev/null 2> "$LOG/$name.err" || status=1
+
+    # xemu: <exit> (status N): <insns> insns in <secs>s, <mips> MIPS
+    summary=$(grep '^xemu: ' "$LOG/$name.err" | tail -n 1)
+    if [ -z "$summary" ]; then
+        cat "$LOG/$name.err" >&2
+        printf "%s\terror\t-\t-\t-\t\n" "$name"
+        status=1
+        continue
+    fi
+
+    counters=$(awk '$1 == "bench" { printf "%s%s=%s", sep, $2, $3; sep = "," }' \
+               "$LOG/$name.out")
+
+    echo "$summary" | sed -n \
+        "s/^xemu: \(.*\) (status .*): \([0-9]*\) insns in \([0-9.]*\)s, \([0-9.]*\) MIPS$/$name\t\1\t\2\t\3\t\4\t$counters/p"
+done
+
+exit $status
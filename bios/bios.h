@@ -17,6 +17,9 @@
 #define DTB_LOAD_ADDR       (ROM_BASE + 0x100)
 #define SBI_LOAD_ADDR       (ROM_BASE + 0x2000)
 
+/* The last 8 bytes before SBI hold the size of sbi. */
+#define DTB_SIZE_MAX        (SBI_LOAD_ADDR - DTB_LOAD_ADDR - 8)
+
 /*
  * Payload(0x100 ~ ): U-boot spl or kernel.
  * Based on FLASH
@@ -0,0 +1,122 @@
+/*
+ * Boot
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "util.h"
+#include "elf.h"
+#include "regfile.h"
+#include "boot.h"
+#include "bios/bios.h"
+
+static void
+_read_at(int fd, uint8_t *dst, size_t size, uint64_t offset,
+         const char *filename)
+{
+    ssize_t ret;
+
+    while (size) {
+        ret = pread(fd, dst, size, (off_t)offset);
+        if (ret <= 0)
+            panic("%s: read %s failed\n", __func__, filename);
+
+        dst += ret;
+        size -= (size_t)ret;
+        offset += (uint64_t)ret;
+    }
+}
+
+static uint64_t
+_load_elf(device_t *ram, int fd, const char *filename)
+{
+    int i;
+    elf64_hdr hdr;
+    elf64_phdr phdr;
+    uint64_t entry = 0;
+
+    _read_at(fd, (uint8_t *)&hdr, sizeof(hdr), 0, filename);
+
+    if (hdr.e_phentsize != sizeof(phdr))
+        panic("%s: bad program header size %u in %s\n",
+              __func__, hdr.e_phentsize, filename);
+
+    for (i = 0; i < hdr.e_phnum; i++) {
+        uint8_t *ptr;
+
+        _read_at(fd, (uint8_t *)&phdr, sizeof(phdr),
+                 hdr.e_phoff + (uint64_t)i * hdr.e_phentsize, filename);
+
+        if (phdr.p_type != PT_LOAD || phdr.p_memsz == 0)
+            continue;
+
+        if (phdr.p_filesz > phdr.p_memsz ||
+            phdr.p_paddr + phdr.p_memsz < phdr.p_paddr)
+            panic("%s: bad segment %d in %s\n", __func__, i, filename);
+
+        ptr = ram_ptr(ram, phdr.p_paddr, phdr.p_memsz);
+        _read_at(fd, ptr, phdr.p_filesz, phdr.p_offset, filename);
+        memset(ptr + phdr.p_filesz, 0, phdr.p_memsz - phdr.p_filesz);
+
+        /* Kernels are linked at virtual addresses, so move entry
+         * to the physical address of the segment that holds it. */
+        if (hdr.e_entry >= phdr.p_vaddr &&
+            hdr.e_entry < phdr.p_vaddr + phdr.p_memsz)
+            entry = hdr.e_entry - phdr.p_vaddr + phdr.p_paddr;
+    }
+
+    if (entry == 0)
+        panic("%s: no entry in %s\n", __func__, filename);
+
+    return entry;
+}
+
+uint64_t
+boot_load_image(device_t *ram, const char *filename, uint64_t addr)
+{
+    int fd;
+    uint64_t entry;
+    struct stat info;
+    uint8_t ident[EI_NIDENT] = {0};
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0 || fstat(fd, &info) < 0)
+        panic("%s: bad filename %s\n", __func__, filename);
+
+    if (info.st_size >= (off_t)sizeof(elf64_hdr))
+        _read_at(fd, ident, sizeof(ident), 0, filename);
+
+    if (elf64_hdr_check(ident)) {
+        entry = _load_elf(ram, fd, filename);
+    } else {
+        uint8_t *ptr = ram_ptr(ram, addr, (size_t)info.st_size);
+        _read_at(fd, ptr, (size_t)info.st_size, 0, filename);
+        entry = addr;
+    }
+
+    close(fd);
+
+    printf("%s: load %s (entry 0x%lx)\n", __func__, filename, entry);
+    return entry;
+}
+
+uint64_t
+boot_direct(device_t *ram, const char *firmware,
+            const char *kernel, uint64_t kernel_addr)
+{
+    uint64_t entry;
+
+    entry = boot_load_image(ram, kernel, kernel_addr);
+    if (firmware)
+        entry = boot_load_image(ram, firmware, SBI_LINK_ADDR);
+
+    /* Same as the head of bios.bin */
+    reg[REG_A0] = 0;    /* mhartid */
+    reg[REG_A1] = DTB_LOAD_ADDR;
+
+    return entry;
+}
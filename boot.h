@@ -0,0 +1,30 @@
+/*
+ * Boot
+ */
+
+#ifndef _BOOT_H_
+#define _BOOT_H_
+
+#include <stdint.h>
+
+#include "device.h"
+
+/*
+ * Load an image into ram. ELF images are placed by their PT_LOAD
+ * program headers, anything else is copied flat to @addr.
+ * Returns the physical entry of the image.
+ */
+uint64_t
+boot_load_image(device_t *ram, const char *filename, uint64_t addr);
+
+/*
+ * Do what bios.bin does without running it: place firmware and kernel
+ * in ram and setup a0/a1 for the firmware. Firmware can be NULL, then
+ * the kernel is entered directly.
+ * Returns the pc to start with.
+ */
+uint64_t
+boot_direct(device_t *ram, const char *firmware,
+            const char *kernel, uint64_t kernel_addr);
+
+#endif /* _BOOT_H_ */
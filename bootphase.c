@@ -0,0 +1,183 @@
+/*
+ * Boot phases
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bootphase.h"
+#include "util.h"
+#include "csr.h"
+#include "regfile.h"
+#include "timeline.h"
+#include "system_map.h"
+#include "bios/bios.h"
+
+#define BOOTPHASE_MARKS     256
+
+typedef struct _boot_mark {
+    const char  *name;
+    int64_t     ns;
+    uint64_t    icount;
+} boot_mark;
+
+typedef struct _bootphase_t {
+    const char  *filename;
+
+    boot_mark   marks[BOOTPHASE_MARKS];
+    uint32_t    nr_marks;
+    uint32_t    dropped;
+
+    bool        started;
+    bool        s_mode;
+    bool        u_mode;
+} bootphase_t;
+
+__thread bool bootphase_on;
+__thread uint64_t bootphase_watch[BOOTPHASE_WATCH];
+
+static __thread bootphase_t *boot;
+
+void
+bootphase_mark(const char *name)
+{
+    boot_mark *mark;
+
+    if (boot == NULL)
+        return;
+
+    if (boot->nr_marks == BOOTPHASE_MARKS) {
+        boot->dropped++;
+        return;
+    }
+
+    mark = &boot->marks[boot->nr_marks++];
+    mark->name = name;
+    mark->ns = get_clock();
+    mark->icount = _insn_count;
+
+    timeline_instant(name, "icount", _insn_count);
+}
+
+void
+_bootphase_hit(uint64_t pc)
+{
+    if (pc == bootphase_watch[0]) {
+        bootphase_mark("firmware entry");
+        bootphase_watch[0] = 0;
+    } else if (pc == bootphase_watch[1]) {
+        bootphase_mark("start_kernel");
+        bootphase_watch[1] = 0;
+    } else {
+        bootphase_mark("do_init_module");
+    }
+}
+
+void
+_bootphase_priv(uint32_t priv)
+{
+    if (priv == S_MODE && !boot->s_mode) {
+        bootphase_mark("first S-mode");
+        boot->s_mode = true;
+    } else if (priv == U_MODE && !boot->u_mode) {
+        bootphase_mark("first U-mode");
+        boot->u_mode = true;
+    }
+}
+
+void
+bootphase_start(uint64_t pc)
+{
+    if (boot == NULL || boot->started)
+        return;
+
+    boot->started = true;
+    bootphase_mark(pc == ROM_BASE ? "bios" : "first fetch");
+
+    /* Direct boot starts in the firmware */
+    bootphase_jump(pc);
+}
+
+static void
+_dump(void)
+{
+    uint32_t i;
+    FILE *fp = report_open(boot->filename);
+
+    if (fp == NULL)
+        return;
+
+    fprintf(fp, "== boot phases\n");
+    fprintf(fp, "%-24s %10s %14s   %10s %14s %8s\n", "milestone",
+            "ms", "insns", "phase ms", "phase insns", "MIPS");
+
+    for (i = 0; i < boot->nr_marks; i++) {
+        boot_mark *mark = &boot->marks[i];
+        int64_t ns = mark->ns - boot->marks[0].ns;
+
+        fprintf(fp, "%-24s %10.3f %14lu", mark->name,
+                (double)ns / 1e6, mark->icount);
+
+        /* What it took to get here from the one before */
+        if (i > 0) {
+            int64_t phase_ns = mark->ns - boot->marks[i - 1].ns;
+            uint64_t phase_insns = mark->icount - boot->marks[i - 1].icount;
+
+            fprintf(fp, "   %10.3f %14lu %8.1f", (double)phase_ns / 1e6,
+                    phase_insns, phase_ns > 0 ?
+                    (double)phase_insns * 1e3 / (double)phase_ns : 0.0);
+        }
+        fputc('\n', fp);
+    }
+
+    if (boot->dropped)
+        fprintf(fp, "%u milestones dropped\n", boot->dropped);
+
+    report_close(fp);
+}
+
+void
+bootphase_init(const char *filename)
+{
+    bootphase_on = false;
+    memset(bootphase_watch, 0, sizeof(bootphase_watch));
+    boot = NULL;
+
+    if (filename == NULL)
+        return;
+
+    boot = calloc(1, sizeof(bootphase_t));
+    if (boot == NULL)
+        panic("%s: alloc failed\n", __func__);
+
+    boot->filename = filename;
+
+    /* A pc is never 0, so a symbol missing from System.map never hits */
+    bootphase_watch[0] = SBI_LINK_ADDR;
+    match_in_system_map("start_kernel", &bootphase_watch[1]);
+    match_in_system_map("do_init_module", &bootphase_watch[2]);
+
+    bootphase_mark("machine create");
+    bootphase_on = true;
+}
+
+void
+bootphase_exit(void)
+{
+    if (boot == NULL)
+        return;
+
+    /* Always room for the last one */
+    if (boot->nr_marks == BOOTPHASE_MARKS) {
+        boot->nr_marks--;
+        boot->dropped++;
+    }
+
+    bootphase_mark("exit");
+    _dump();
+
+    free(boot);
+    boot = NULL;
+    bootphase_on = false;
+}
@@ -0,0 +1,64 @@
+/*
+ * Boot phases
+ *
+ * Wall time and retired instructions at boot milestones: first fetch,
+ * entry of the firmware, first S-mode instruction, start_kernel, each
+ * do_init_module, each flash file the guest reads and first U-mode
+ * instruction. The breakdown between them is written on exit.
+ *
+ * Off unless bootphase_init() is given a file; while on, a taken jump
+ * pays a compare with each watched pc.
+ */
+
+#ifndef _BOOTPHASE_H_
+#define _BOOTPHASE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Firmware entry, start_kernel and do_init_module */
+#define BOOTPHASE_WATCH     3
+
+extern __thread bool bootphase_on;
+extern __thread uint64_t bootphase_watch[BOOTPHASE_WATCH];
+
+void
+_bootphase_hit(uint64_t pc);
+
+void
+_bootphase_priv(uint32_t priv);
+
+/* On every taken jump, @pc is where it lands */
+static inline void
+bootphase_jump(uint64_t pc)
+{
+    if (bootphase_on &&
+        (pc == bootphase_watch[0] || pc == bootphase_watch[1] ||
+         pc == bootphase_watch[2]))
+        _bootphase_hit(pc);
+}
+
+/* After xRET switched to a lower @priv */
+static inline void
+bootphase_priv(uint32_t priv)
+{
+    if (bootphase_on)
+        _bootphase_priv(priv);
+}
+
+/* Record a milestone now, @name must live as long as the process */
+void
+bootphase_mark(const char *name);
+
+/* First instruction is about to be fetched from @pc */
+void
+bootphase_start(uint64_t pc);
+
+/* Write to @filename ("-" for stderr) on exit */
+void
+bootphase_init(const char *filename);
+
+void
+bootphase_exit(void);
+
+#endif /* _BOOTPHASE_H_ */
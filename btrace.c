@@ -0,0 +1,205 @@
+/*
+ * Binary trace
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "btrace.h"
+#include "util.h"
+#include "machine.h"
+
+#define BTRACE_RING_SIZE    (4UL << 20)     /* Power of 2 */
+#define BTRACE_RECORD_MAX   48
+
+/*
+ * Single producer (cpu thread), single consumer (writer thread).
+ * head and tail only grow; the ring offset is their low bits.
+ */
+typedef struct _btrace_t {
+    uint8_t     *ring;
+    uint64_t    head;
+    uint64_t    tail;
+
+    FILE        *fp;
+    pthread_t   tid;
+    bool        exiting;
+
+    /* Producer side */
+    uint64_t    next_pc;
+    uint64_t    prev_addr;
+    uint64_t    records;
+    uint64_t    stalls;     /* Times the writer fell behind */
+} btrace_t;
+
+__thread bool btrace_on;
+
+static __thread btrace_t *bt;
+
+static uint64_t
+_room(uint64_t head)
+{
+    return BTRACE_RING_SIZE - (head - __atomic_load_n(&bt->tail,
+                                                      __ATOMIC_ACQUIRE));
+}
+
+static size_t
+_put_varint(uint8_t *p, uint64_t v)
+{
+    size_t n = 0;
+
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+
+    return n;
+}
+
+void
+btrace_record(uint64_t pc, uint32_t inst, uint32_t opcode,
+              uint32_t rd, uint64_t addr)
+{
+    size_t off;
+    size_t len = 1;
+    uint8_t rec[BTRACE_RECORD_MAX];
+    uint8_t flags = 0;
+    uint64_t head = bt->head;
+
+    if (pc != bt->next_pc) {
+        flags |= BTRACE_F_JUMP;
+        len += _put_varint(rec + len,
+                           btrace_zigzag((int64_t)(pc - bt->next_pc)));
+    }
+
+    if ((inst & 0x3) != 0x3) {
+        flags |= BTRACE_F_RVC;
+        memcpy(rec + len, &inst, 2);
+        len += 2;
+        bt->next_pc = pc + 2;
+    } else {
+        memcpy(rec + len, &inst, 4);
+        len += 4;
+        bt->next_pc = pc + 4;
+    }
+
+    if (rd && opcode != OP_STORE && opcode != OP_STORE_FP &&
+        opcode != OP_BRANCH) {
+        uint64_t val = (opcode == OP_LOAD_FP || opcode == OP_FP) ?
+            freg[rd] : reg[rd];
+
+        flags |= BTRACE_F_RD;
+        len += _put_varint(rec + len, val);
+    }
+
+    if (addr != BTRACE_NO_ADDR) {
+        flags |= BTRACE_F_MEM;
+        len += _put_varint(rec + len,
+                           btrace_zigzag((int64_t)(addr - bt->prev_addr)));
+        bt->prev_addr = addr;
+    }
+
+    rec[0] = flags;
+
+    /* Lossless: wait for the writer rather than drop */
+    if (_room(head) < len) {
+        bt->stalls++;
+        while (_room(head) < len)
+            sched_yield();
+    }
+
+    off = head & (BTRACE_RING_SIZE - 1);
+    if (off + len <= BTRACE_RING_SIZE) {
+        memcpy(bt->ring + off, rec, len);
+    } else {
+        size_t first = BTRACE_RING_SIZE - off;
+        memcpy(bt->ring + off, rec, first);
+        memcpy(bt->ring, rec + first, len - first);
+    }
+
+    __atomic_store_n(&bt->head, head + len, __ATOMIC_RELEASE);
+    bt->records++;
+}
+
+static void *
+_writer(void *opaque)
+{
+    btrace_t *b = opaque;
+
+    for (;;) {
+        size_t off;
+        size_t len;
+        bool done = __atomic_load_n(&b->exiting, __ATOMIC_ACQUIRE);
+        uint64_t head = __atomic_load_n(&b->head, __ATOMIC_ACQUIRE);
+
+        if (head == b->tail) {
+            if (done)
+                break;
+
+            usleep(1000);
+            continue;
+        }
+
+        off = b->tail & (BTRACE_RING_SIZE - 1);
+        len = head - b->tail;
+        if (off + len > BTRACE_RING_SIZE)
+            len = BTRACE_RING_SIZE - off;
+
+        if (fwrite(b->ring + off, 1, len, b->fp) != len)
+            panic("%s: write trace failed\n", __func__);
+
+        __atomic_store_n(&b->tail, b->tail + len, __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+}
+
+void
+btrace_init(const char *filename)
+{
+    btrace_header hdr = {0};
+
+    btrace_on = false;
+    bt = NULL;
+
+    if (filename == NULL)
+        return;
+
+    bt = calloc(1, sizeof(btrace_t));
+    bt->ring = malloc(BTRACE_RING_SIZE);
+    bt->fp = fopen(filename, "wb");
+    if (bt->ring == NULL || bt->fp == NULL)
+        panic("%s: cannot trace to %s\n", __func__, filename);
+
+    hdr.magic = BTRACE_MAGIC;
+    hdr.version = BTRACE_VERSION;
+    if (fwrite(&hdr, sizeof(hdr), 1, bt->fp) != 1)
+        panic("%s: write trace failed\n", __func__);
+
+    machine_thread_create(&bt->tid, "btrace", _writer, bt);
+    btrace_on = true;
+}
+
+void
+btrace_exit(void)
+{
+    if (bt == NULL)
+        return;
+
+    __atomic_store_n(&bt->exiting, true, __ATOMIC_RELEASE);
+    pthread_join(bt->tid, NULL);
+    fclose(bt->fp);
+
+    fprintf(stderr, "btrace: %lu records, writer fell behind %lu times\n",
+            bt->records, bt->stalls);
+
+    free(bt->ring);
+    free(bt);
+    bt = NULL;
+    btrace_on = false;
+}
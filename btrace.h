@@ -0,0 +1,86 @@
+/*
+ * Binary trace
+ *
+ * One record per retired instruction, packed by the cpu thread into a
+ * ring buffer and written out by a background thread. Decode a trace
+ * with tools/xemu-trace.
+ *
+ * File: header, then records:
+ *   u8       flags (BTRACE_F_*)
+ *   varint   zigzag (pc - expected pc), if BTRACE_F_JUMP; the expected
+ *            pc follows the previous instruction, 0 at the start
+ *   u16/u32  raw instruction, u16 if BTRACE_F_RVC
+ *   varint   rd value, if BTRACE_F_RD
+ *   varint   zigzag (address - previous address), if BTRACE_F_MEM
+ * Varints are LEB128, 7 bits per byte with the low bits first.
+ */
+
+#ifndef _BTRACE_H_
+#define _BTRACE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "isa.h"
+#include "regfile.h"
+
+#define BTRACE_MAGIC    0x43415254554d4558UL    /* 'XEMUTRAC' */
+#define BTRACE_VERSION  1
+
+#define BTRACE_F_RVC    0x01
+#define BTRACE_F_JUMP   0x02
+#define BTRACE_F_RD     0x04
+#define BTRACE_F_MEM    0x08
+
+#define BTRACE_NO_ADDR  (~0UL)
+
+typedef struct _btrace_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t reserved;
+} btrace_header;
+
+extern __thread bool btrace_on;
+
+void
+btrace_init(const char *filename);
+
+/* Drains the ring and closes the file */
+void
+btrace_exit(void);
+
+void
+btrace_record(uint64_t pc, uint32_t inst, uint32_t opcode,
+              uint32_t rd, uint64_t addr);
+
+/* Data address of a load, store or amo; before it executes */
+static inline uint64_t
+btrace_addr(uint32_t opcode, uint32_t rs1, uint64_t imm)
+{
+    switch (opcode)
+    {
+    case OP_LOAD:
+    case OP_LOAD_FP:
+    case OP_STORE:
+    case OP_STORE_FP:
+        return reg[rs1] + imm;
+    case OP_AMO:
+        return reg[rs1];
+    default:
+        return BTRACE_NO_ADDR;
+    }
+}
+
+static inline uint64_t
+btrace_zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t
+btrace_unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+#endif /* _BTRACE_H_ */
@@ -10,6 +10,12 @@
 #include "address_space.h"
 #include "device.h"
 #include "util.h"
+#include "snapshot.h"
+#include "replay.h"
+#include "machine.h"
+#include "timeline.h"
+#include "irqlat.h"
+#include "probes.h"
 
 #define CLINT_ADDRESS_SPACE_START 0x0000000002000000
 #define CLINT_ADDRESS_SPACE_END   0x000000000200FFFF
@@ -18,29 +24,33 @@
 #define CLINT_MTIMECMP  0x4000
 #define CLINT_MTIME     0xBFF8
 
-static bool _software_intr;
-static bool _timer_intr;
-
 typedef struct _clint_t
 {
     device_t dev;
 
+    pthread_t tid;
     pthread_mutex_t _mutex;
     pthread_cond_t _cond;
+    bool exiting;
+
+    bool software_intr;
+    bool timer_intr;
 
     bool timer_running;
 
     uint64_t mtimecmp;
 } clint_t;
 
+static __thread clint_t *cpu_clint;     /* Of the machine on this cpu */
+
 
 intr_type_t
 clint_interrupt(void)
 {
-    if (_timer_intr)
+    if (cpu_clint->timer_intr)
         return TIMER_INTR_TYPE;
 
-    if (_software_intr)
+    if (cpu_clint->software_intr)
         return SOFTWARE_INTR_TYPE;
 
     return INTR_TYPE_NONE;
@@ -68,15 +78,23 @@ clint_write(void *dev, uint64_t addr, uint64_t data, size_t size,
     switch (addr)
     {
     case CLINT_MSIP:
-        _software_intr = (bool) data;
+        clint->software_intr = (bool) data;
+        if (data)
+            irqlat_assert(IRQLAT_SOFT);
+        else
+            irqlat_clear(IRQLAT_SOFT);
         break;
     case CLINT_MTIMECMP:
         pthread_mutex_lock(&clint->_mutex);
-        _timer_intr = false;
+        clint->timer_intr = false;
         clint->mtimecmp = data;
+        irqlat_clear(IRQLAT_TIMER);
 
-        if (cpu_read_rtc() > clint->mtimecmp) {
-            _timer_intr = true;
+        if (replay_value(REPLAY_TIME, cpu_read_rtc()) > clint->mtimecmp) {
+            timeline_instant("timer fire", "mtimecmp", data);
+            PROBE1(timer_fire, data);
+            irqlat_assert(IRQLAT_TIMER);
+            clint->timer_intr = true;
         } else {
             clint->timer_running = true;
         }
@@ -99,11 +117,11 @@ _routine(void *arg)
     while (1) {
         pthread_mutex_lock(&clint->_mutex);
 
-        while (!clint->timer_running) {
+        while (!clint->timer_running && !clint->exiting) {
             pthread_cond_wait(&clint->_cond, &clint->_mutex);
         }
 
-        while (cpu_read_rtc() < clint->mtimecmp) {
+        while (cpu_read_rtc() < clint->mtimecmp && !clint->exiting) {
             struct timeval now;
             struct timespec next_time;
             gettimeofday(&now, NULL);
@@ -112,7 +130,22 @@ _routine(void *arg)
             pthread_cond_timedwait(&clint->_cond, &clint->_mutex, &next_time);
         }
 
-        _timer_intr = true;
+        if (clint->exiting) {
+            pthread_mutex_unlock(&clint->_mutex);
+            break;
+        }
+
+        timeline_instant("timer fire", "mtimecmp", clint->mtimecmp);
+        PROBE1(timer_fire, clint->mtimecmp);
+
+        /* On replay, the timer fires when the log says so */
+        if (replay_mode == REPLAY_NONE) {
+            irqlat_assert(IRQLAT_TIMER);
+            clint->timer_intr = true;
+        }
+        else if (replay_mode == REPLAY_RECORD)
+            replay_async(REPLAY_TIMER, clint->mtimecmp);
+
         clint->timer_running = false;
         pthread_mutex_unlock(&clint->_mutex);
     }
@@ -120,14 +153,58 @@ _routine(void *arg)
     return NULL;
 }
 
+/* Applied by the cpu; stale if mtimecmp was written in between */
+static void
+_timer_fire(uint64_t data, void *opaque)
+{
+    clint_t *clint = (clint_t *) opaque;
+
+    if (data == clint->mtimecmp) {
+        irqlat_assert(IRQLAT_TIMER);
+        clint->timer_intr = true;
+    }
+}
+
+static void
+_clint_release(device_t *dev)
+{
+    clint_t *clint = (clint_t *) dev;
+
+    pthread_mutex_lock(&clint->_mutex);
+    clint->exiting = true;
+    pthread_cond_signal(&clint->_cond);
+    pthread_mutex_unlock(&clint->_mutex);
+
+    pthread_join(clint->tid, NULL);
+
+    pthread_mutex_destroy(&clint->_mutex);
+    pthread_cond_destroy(&clint->_cond);
+    free(clint);
+}
+
+/* Restart the timer thread if it was waiting for mtimecmp */
+static void
+_clint_post_load(void *opaque)
+{
+    clint_t *clint = (clint_t *) opaque;
+
+    pthread_mutex_lock(&clint->_mutex);
+    pthread_cond_signal(&clint->_cond);
+    pthread_mutex_unlock(&clint->_mutex);
+}
+
+static const snapshot_ops clint_ops = {
+    .post_load = _clint_post_load,
+};
+
 device_t *
 clint_init(address_space *parent_as)
 {
-    pthread_t tid;
     clint_t *clint;
 
     clint = calloc(1, sizeof(clint_t));
     clint->dev.name = "clint";
+    clint->dev.release = _clint_release;
 
     init_address_space(&(clint->dev.as),
                        CLINT_ADDRESS_SPACE_START,
@@ -143,7 +220,18 @@ clint_init(address_space *parent_as)
     pthread_mutex_init(&clint->_mutex, NULL);
     pthread_cond_init(&clint->_cond, NULL);
 
-    pthread_create(&tid, NULL, _routine, clint);
+    snapshot_register("clint", &clint->timer_running,
+                      sizeof(clint_t) - offsetof(clint_t, timer_running),
+                      &clint_ops, clint);
+    snapshot_register("clint.msip", &clint->software_intr,
+                      sizeof(clint->software_intr), NULL, NULL);
+    snapshot_register("clint.mtip", &clint->timer_intr,
+                      sizeof(clint->timer_intr), NULL, NULL);
+
+    replay_register(REPLAY_TIMER, _timer_fire, clint);
+
+    cpu_clint = clint;
+    machine_thread_create(&clint->tid, "clint", _routine, clint);
 
     return (device_t *) clint;
 }
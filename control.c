@@ -0,0 +1,230 @@
+/*
+ * Control socket
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "util.h"
+#include "list.h"
+#include "control.h"
+#include "machine.h"
+
+typedef struct _control_cmd {
+    list_head   entry;
+    const char  *name;
+    const char  *help;
+    control_cb  cb;
+    void        *opaque;
+    machine_t   *m;             /* Registered by, NULL for built-in */
+} control_cmd;
+
+static LIST_HEAD(commands);
+static pthread_mutex_t control_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static bool listening;
+static machine_t *owner;        /* Machine the commands act on */
+
+void
+control_register(const char *name, const char *help,
+                 control_cb cb, void *opaque)
+{
+    control_cmd *cmd;
+
+    if (!listening)
+        return;
+
+    pthread_mutex_lock(&control_mutex);
+
+    if (!control_own(&owner)) {
+        pthread_mutex_unlock(&control_mutex);
+        return;
+    }
+
+    cmd = calloc(1, sizeof(control_cmd));
+    cmd->name = name;
+    cmd->help = help;
+    cmd->cb = cb;
+    cmd->opaque = opaque;
+    cmd->m = _machine;
+
+    list_add_tail(&(cmd->entry), &commands);
+    pthread_mutex_unlock(&control_mutex);
+}
+
+void
+control_detach(machine_t *m)
+{
+    list_head *pos;
+    list_head *n;
+
+    if (!listening)
+        return;
+
+    pthread_mutex_lock(&control_mutex);
+
+    list_for_each_safe(pos, n, &commands) {
+        control_cmd *cmd = list_entry(pos, control_cmd, entry);
+        if (cmd->m == m) {
+            list_del(pos);
+            free(cmd);
+        }
+    }
+
+    if (owner == m)
+        owner = NULL;
+
+    pthread_mutex_unlock(&control_mutex);
+}
+
+bool
+control_own(machine_t **owner)
+{
+    if (*owner == NULL)
+        *owner = _machine;
+
+    return *owner == _machine;
+}
+
+int
+control_send_fd(int conn, int fd, const char *msg)
+{
+    struct msghdr hdr = {0};
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char buf[CMSG_SPACE(sizeof(int))] = {0};
+
+    iov.iov_base = (void *)msg;
+    iov.iov_len = strlen(msg);
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = buf;
+    hdr.msg_controllen = sizeof(buf);
+
+    cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    return (sendmsg(conn, &hdr, MSG_NOSIGNAL) < 0) ? -1 : 0;
+}
+
+static void
+_help(FILE *out, int conn, const char *args, void *opaque)
+{
+    control_cmd *cmd;
+
+    list_for_each_entry(cmd, &commands, entry)
+        fprintf(out, "%-12s %s\n", cmd->name, cmd->help);
+}
+
+/* Nonzero once the reply cannot be written, the client went away */
+static int
+_dispatch(FILE *out, int conn, char *line)
+{
+    char *args;
+    control_cmd *cmd;
+
+    line[strcspn(line, "\r\n")] = '\0';
+    if (*line == '\0')
+        return 0;
+
+    args = strchr(line, ' ');
+    if (args)
+        *args++ = '\0';
+    else
+        args = "";
+
+    /* Held over the callback, the machine may be going away */
+    pthread_mutex_lock(&control_mutex);
+    _machine = owner;
+
+    list_for_each_entry(cmd, &commands, entry) {
+        if (streq(cmd->name, line)) {
+            cmd->cb(out, conn, args, cmd->opaque);
+            pthread_mutex_unlock(&control_mutex);
+            return fflush(out);
+        }
+    }
+    pthread_mutex_unlock(&control_mutex);
+
+    fprintf(out, "error: unknown command '%s'\n", line);
+    return fflush(out);
+}
+
+static void *
+_routine(void *arg)
+{
+    int sock = (int)(intptr_t)arg;
+
+    while (1) {
+        FILE *in;
+        FILE *out;
+        char line[256];
+        int conn = accept(sock, NULL, NULL);
+        if (conn < 0)
+            continue;
+
+        in = fdopen(conn, "r");
+        out = fdopen(dup(conn), "w");
+        if (in == NULL || out == NULL)
+            panic("%s: fdopen failed\n", __func__);
+
+        while (fgets(line, sizeof(line), in) != NULL) {
+            if (_dispatch(out, conn, line))
+                break;
+        }
+
+        fclose(out);
+        fclose(in);
+    }
+
+    return NULL;
+}
+
+int
+control_listen(const char *path)
+{
+    int sock;
+    struct sockaddr_un addr = {0};
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        panic("%s: path too long %s\n", __func__, path);
+
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0 ||
+        bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(sock, 4) < 0)
+        panic("%s: cannot listen on %s\n", __func__, path);
+
+    signal(SIGPIPE, SIG_IGN);
+
+    return sock;
+}
+
+void
+control_init(const char *path)
+{
+    int sock;
+    pthread_t tid;
+
+    sock = control_listen(path);
+
+    listening = true;
+    control_register("help", "list commands", _help, NULL);
+
+    pthread_create(&tid, NULL, _routine, (void *)(intptr_t)sock);
+
+    printf("%s: listen on %s\n", __func__, path);
+}
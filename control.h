@@ -0,0 +1,54 @@
+/*
+ * Control socket
+ */
+
+#ifndef _CONTROL_H_
+#define _CONTROL_H_
+
+#include <stdio.h>
+
+#include "machine.h"
+
+/*
+ * Commands are single lines "<name> [args]\n" sent to a local unix
+ * socket. The callback runs on the control thread and writes its
+ * reply to @out.
+ */
+typedef void (*control_cb)(FILE *out, int conn, const char *args,
+                           void *opaque);
+
+/* A no-op unless control_init() was called */
+void
+control_register(const char *name, const char *help,
+                 control_cb cb, void *opaque);
+
+/*
+ * Call before machine_create(). Commands act on the first machine that
+ * registers one.
+ */
+void
+control_init(const char *path);
+
+/* Drop the commands of @m, the next machine created takes over */
+void
+control_detach(machine_t *m);
+
+/*
+ * Listening unix socket at @path, for this and the metrics socket.
+ * Ignores SIGPIPE, a client that hangs up gives EPIPE instead.
+ */
+int
+control_listen(const char *path);
+
+/*
+ * True if the machine of the calling thread owns *@owner, which it
+ * claims when free. Under the caller's lock.
+ */
+bool
+control_own(machine_t **owner);
+
+/* Pass @fd to the peer with @msg as the payload */
+int
+control_send_fd(int conn, int fd, const char *msg);
+
+#endif /* _CONTROL_H_ */
@@ -0,0 +1,43 @@
+/*
+ * Coverage
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/shm.h>
+
+#include "util.h"
+#include "coverage.h"
+
+uint8_t  *cov_map;
+__thread uint64_t cov_prev;
+
+/*
+ * The map is exported through the SysV shared memory segment that
+ * afl-fuzz passes in __AFL_SHM_ID. Without it coverage stays off.
+ */
+void
+coverage_init(void)
+{
+    void *ptr;
+    const char *id = getenv("__AFL_SHM_ID");
+
+    if (id == NULL)
+        return;
+
+    ptr = shmat(atoi(id), NULL, 0);
+    if (ptr == (void *) -1)
+        panic("%s: cannot attach shm %s\n", __func__, id);
+
+    cov_map = ptr;
+    cov_prev = 0;
+
+    printf("%s: edge coverage to shm %s\n", __func__, id);
+}
+
+/* The map belongs to the fuzzer, only the edge state is per run. */
+void
+coverage_reset(void)
+{
+    cov_prev = 0;
+}
@@ -0,0 +1,35 @@
+/*
+ * Coverage
+ */
+
+#ifndef _COVERAGE_H_
+#define _COVERAGE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define COVERAGE_MAP_SIZE   (1UL << 16)
+
+extern uint8_t  *cov_map;       /* NULL unless coverage is on */
+extern __thread uint64_t cov_prev;
+
+/*
+ * AFL style edge coverage: a hit counter for each (previous, current)
+ * pair of branch targets, hashed into the map.
+ */
+static inline void
+cov_edge(uint64_t pc)
+{
+    uint64_t cur = ((pc >> 4) ^ (pc << 8)) & (COVERAGE_MAP_SIZE - 1);
+
+    cov_map[cur ^ cov_prev]++;
+    cov_prev = cur >> 1;
+}
+
+void
+coverage_init(void);
+
+void
+coverage_reset(void);
+
+#endif /* _COVERAGE_H_ */
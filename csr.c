@@ -2,11 +2,16 @@
  * CSR
  */
 
+#include <string.h>
+
 #include "csr.h"
 #include "util.h"
+#include "snapshot.h"
+#include "replay.h"
+#include "annotate.h"
 
-uint32_t _priv = M_MODE;
-uint64_t _csr[4096] = {0};
+__thread uint32_t _priv = M_MODE;
+__thread uint64_t _csr[4096] = {0};
 
 uint32_t
 priv(void)
@@ -23,7 +28,13 @@ switch_to(uint32_t new_priv)
 void
 csr_init()
 {
+    memset(_csr, 0, sizeof(_csr));
+    _priv = M_MODE;
+
     _csr[MISA] = MISA_INIT_VAL;
+
+    snapshot_register("cpu.csr", _csr, sizeof(_csr), NULL, NULL);
+    snapshot_register("cpu.priv", &_priv, sizeof(_priv), NULL, NULL);
 }
 
 const char *
@@ -148,13 +159,19 @@ _read(uint32_t addr, bool *has_except)
     case PMPADDR0...PMPADDR15:
         return _csr[addr];
 
+    /* 0x8c0 */
+    case XANNOTATE:
+        return annotate_read();
+
     /* 0xc00 ~ 0xc02 */
     case TIME:
-        return cpu_read_rtc();
+        return replay_value(REPLAY_TIME, cpu_read_rtc());
 
     case CYCLE:
+        return replay_value(REPLAY_CYCLE, (uint64_t)cpu_get_host_ticks());
+
     case INSTRET:
-        return (uint64_t)cpu_get_host_ticks();
+        return _insn_count;
 
     /* 0xf11 ~ 0xf14 */
     case MVENDORID:
@@ -204,6 +221,10 @@ csr_update(uint32_t addr, uint64_t data, csr_op_type type, bool *has_except)
         panic("%s: bad csr op %d\n", __func__, type);
     }
 
+    /* csrr is csrrs with x0, only csrw and csrwi send a command */
+    if (addr == XANNOTATE && type == CSR_OP_WRITE)
+        annotate_command(data);
+
     return ret;
 }
 
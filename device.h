@@ -8,18 +8,49 @@
 #include "address_space.h"
 #include "interrupt.h"
 
+/* Devices live between rom and ram */
+#define MMIO_START              0x0000000000100000UL
+#define RAM_ADDRESS_SPACE_START 0x0000000080000000UL
+#define RAM_SIZE_DEFAULT        0x0000000080000000UL
+#define RAM_SIZE_MAX            \
+    (ROOT_ADDRESS_SPACE_END - RAM_ADDRESS_SPACE_START + 1)
+
 typedef struct _device
 {
     const char      *name;
     address_space   as;
+
+    /* Frees the device on machine_destroy(), plain free() if NULL */
+    void            (*release)(struct _device *dev);
+
+    /* Guest accesses, counted by the cpu thread */
+    uint64_t        mmio_reads;
+    uint64_t        mmio_writes;
 } device_t;
 
+/* Kernel modules, read like rom */
+#define FLASH_ADDRESS_SPACE_START 0x0000000020000000UL
+#define FLASH_ADDRESS_SPACE_END   0x0000000023FFFFFFUL
+#define FLASH_ADDRESS_SPACE_SIZE  \
+    (FLASH_ADDRESS_SPACE_END - FLASH_ADDRESS_SPACE_START + 1)
+
+/* Unsigned compares, rom, flash and ram are left out */
+static inline bool
+is_mmio(uint64_t paddr)
+{
+    return paddr - MMIO_START < RAM_ADDRESS_SPACE_START - MMIO_START &&
+        paddr - FLASH_ADDRESS_SPACE_START >= FLASH_ADDRESS_SPACE_SIZE;
+}
+
 device_t *
 rtc_init(address_space *parent_as);
 
 device_t *
 pci_host_init(address_space *parent_as);
 
+device_t *
+sifive_test_init(address_space *parent_as);
+
 device_t *
 plic_init(address_space *parent_as);
 
@@ -35,17 +66,55 @@ flash_add_file(device_t *dev, const char *filename);
 void
 flash_load_modules(device_t *dev);
 
+void
+flash_seal(device_t *dev);
+
+device_t *
+flash_clone(address_space *parent_as, device_t *tmpl);
+
 device_t *
 rom_init(address_space *parent_as);
 
 void
 rom_add_file(device_t *dev, const char *filename, size_t base);
 
+uint8_t *
+rom_ptr(device_t *dev, size_t base, size_t size);
+
+void
+rom_seal(device_t *dev);
+
 device_t *
-ram_init(address_space *parent_as);
+rom_clone(address_space *parent_as, device_t *tmpl);
+
+#define RAM_F_HUGETLB   0x1     /* Back ram with hugetlb pages */
+#define RAM_F_SHARED    0x2     /* Back ram with a memfd */
+
+device_t *
+ram_init(address_space *parent_as, size_t size,
+         const char *mem_path, uint32_t flags);
+
+int
+ram_fd(device_t *dev);
+
+size_t
+ram_size(device_t *dev);
+
+void
+ram_restore(device_t *dev, int fd, uint64_t offset);
+
+void
+ram_track_dirty(device_t *dev);
+
+size_t
+ram_reset_dirty(device_t *dev, int fd, uint64_t offset);
+
+uint8_t *
+ram_ptr(device_t *dev, uint64_t addr, size_t size);
 
 device_t *
-uart_init(address_space *parent_as, uint32_t irq_num);
+uart_init(address_space *parent_as, uint32_t irq_num, bool input,
+          const char *console);
 
 device_t *
 virtio_mmio_init(address_space *parent_as, uint64_t start, uint64_t end);
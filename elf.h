@@ -11,6 +11,10 @@
 
 #define EI_NIDENT   16
 
+/* These constants are for the segment types stored in the image headers */
+#define PT_NULL     0
+#define PT_LOAD     1
+
 typedef struct _elf64_hdr {
     unsigned char e_ident[EI_NIDENT]; /* ELF "magic number" */
     uint16_t e_type;
@@ -28,6 +32,17 @@ typedef struct _elf64_hdr {
     uint16_t e_shstrndx;
 } elf64_hdr;
 
+typedef struct _elf64_phdr {
+    uint32_t p_type;
+    uint32_t p_flags;
+    uint64_t p_offset;          /* Segment file offset */
+    uint64_t p_vaddr;           /* Segment virtual address */
+    uint64_t p_paddr;           /* Segment physical address */
+    uint64_t p_filesz;          /* Segment size in file */
+    uint64_t p_memsz;           /* Segment size in memory */
+    uint64_t p_align;           /* Segment alignment, file & memory */
+} elf64_phdr;
+
 static inline bool
 elf64_hdr_check(void *ptr)
 {
@@ -10,6 +10,9 @@
 #include "util.h"
 #include "trap.h"
 #include "trace.h"
+#include "coverage.h"
+#include "annotate.h"
+#include "probes.h"
 
 uint64_t
 execute(address_space *as,
@@ -292,6 +295,8 @@ execute(address_space *as,
         break;
 
     case SFENCE_VMA:
+        /* No TLB to flush, page walks go to memory every time */
+        PROBE2(tlb_flush, reg[rs1], reg[rs2]);
         break;
 
     case CSRRW:
@@ -300,7 +305,7 @@ execute(address_space *as,
             ret_pc = raise_except(pc, CAUSE_ILLEGAL_INST, 0);
 
         if (csr_addr == 0)
-            fprintf(stderr, "#DEBUG:[%lx]: %lx\n", pc, reg[rs1]);
+            annotate_print(pc, reg[rs1]);
         break;
 
     case CSRRS:
@@ -321,7 +326,7 @@ execute(address_space *as,
             ret_pc = raise_except(pc, CAUSE_ILLEGAL_INST, 0);
 
         if (csr_addr == 0)
-            fprintf(stderr, "#DEBUG:[%lx]: %lx\n", pc, imm);
+            annotate_print(pc, imm);
         break;
 
     case CSRRSI:
@@ -588,5 +593,8 @@ execute(address_space *as,
             reg[rd] = rd_val;
     }
 
+    if (cov_map && op >= JAL && op <= BGEU)
+        cov_edge(ret_pc);
+
     return ret_pc;
 }
@@ -0,0 +1,95 @@
+/*
+ * FDT
+ */
+
+#include <string.h>
+#include <endian.h>
+
+#include "util.h"
+#include "fdt.h"
+
+static uint32_t
+_fdt32(const uint8_t *fdt, size_t offset)
+{
+    uint32_t val;
+    memcpy(&val, fdt + offset, sizeof(val));
+    return be32toh(val);
+}
+
+static void
+_set_fdt64(uint8_t *fdt, size_t offset, uint64_t val)
+{
+    val = htobe64(val);
+    memcpy(fdt + offset, &val, sizeof(val));
+}
+
+void
+fdt_fixup_memory(uint8_t *fdt, size_t size, uint64_t base, uint64_t len)
+{
+    int depth = 0;
+    bool in_memory = false;
+    size_t offset;
+    size_t end;
+    size_t strings;
+
+    if (size < sizeof(fdt_header) || _fdt32(fdt, 0) != FDT_MAGIC)
+        panic("%s: bad fdt\n", __func__);
+
+    offset = _fdt32(fdt, offsetof(fdt_header, off_dt_struct));
+    end = offset + _fdt32(fdt, offsetof(fdt_header, size_dt_struct));
+    strings = _fdt32(fdt, offsetof(fdt_header, off_dt_strings));
+    if (end > size || strings > size)
+        panic("%s: fdt out of limit 0x%lx\n", __func__, size);
+
+    while (offset < end) {
+        uint32_t token = _fdt32(fdt, offset);
+        offset += 4;
+
+        switch (token)
+        {
+        case FDT_BEGIN_NODE:
+            depth++;
+            if (depth == 2)
+                in_memory = !strncmp((const char *)fdt + offset,
+                                     "memory", 6);
+            offset += ROUND_UP(strlen((const char *)fdt + offset) + 1, 4UL);
+            break;
+
+        case FDT_END_NODE:
+            depth--;
+            in_memory = false;
+            break;
+
+        case FDT_PROP: {
+            uint32_t plen = _fdt32(fdt, offset);
+            uint32_t nameoff = _fdt32(fdt, offset + 4);
+            offset += 8;
+
+            if (in_memory && depth == 2 &&
+                streq((const char *)fdt + strings + nameoff, "reg")) {
+                if (plen != 16)
+                    panic("%s: bad memory reg len %u\n", __func__, plen);
+
+                _set_fdt64(fdt, offset, base);
+                _set_fdt64(fdt, offset + 8, len);
+                return;
+            }
+
+            offset += ROUND_UP((size_t)plen, 4UL);
+            break;
+        }
+
+        case FDT_NOP:
+            break;
+
+        case FDT_END:
+            offset = end;
+            break;
+
+        default:
+            panic("%s: bad token 0x%x\n", __func__, token);
+        }
+    }
+
+    panic("%s: no memory node\n", __func__);
+}
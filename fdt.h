@@ -0,0 +1,39 @@
+/*
+ * FDT
+ */
+
+#ifndef _FDT_H_
+#define _FDT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FDT_MAGIC       0xd00dfeed
+
+#define FDT_BEGIN_NODE  0x1     /* Start node: full name */
+#define FDT_END_NODE    0x2     /* End node */
+#define FDT_PROP        0x3     /* Property: name off, size, content */
+#define FDT_NOP         0x4     /* nop */
+#define FDT_END         0x9
+
+typedef struct _fdt_header {
+    uint32_t magic;             /* magic word FDT_MAGIC */
+    uint32_t totalsize;         /* total size of DT block */
+    uint32_t off_dt_struct;     /* offset to structure */
+    uint32_t off_dt_strings;    /* offset to strings */
+    uint32_t off_mem_rsvmap;    /* offset to memory reserve map */
+    uint32_t version;           /* format version */
+    uint32_t last_comp_version; /* last compatible version */
+    uint32_t boot_cpuid_phys;   /* Which physical CPU id we're booting on */
+    uint32_t size_dt_strings;   /* size of the strings block */
+    uint32_t size_dt_struct;    /* size of the structure block */
+} fdt_header;
+
+/*
+ * Rewrite 'reg' of the top-level memory node in place.
+ * Root #address-cells and #size-cells must both be 2.
+ */
+void
+fdt_fixup_memory(uint8_t *fdt, size_t size, uint64_t base, uint64_t len);
+
+#endif /* _FDT_H_ */
@@ -5,6 +5,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <malloc.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include "util.h"
@@ -12,22 +14,32 @@
 #include "device.h"
 #include "elf.h"
 #include "module.h"
+#include "bootphase.h"
 
 #define FLASH_HEAD_SIZE 0x100
 
-#define FLASH_ADDRESS_SPACE_START 0x0000000020000000UL
-#define FLASH_ADDRESS_SPACE_END   0x0000000023FFFFFFUL
-#define FLASH_ADDRESS_SPACE_SIZE  \
-    (FLASH_ADDRESS_SPACE_END - FLASH_ADDRESS_SPACE_START + 1)
-
 typedef struct _flash_t
 {
     device_t dev;
 
     uint8_t *mem_ptr;
     size_t  mem_size;
+
+    int     fd;         /* Sealed contents, -1 while files are added */
+    bool    mapped;     /* mem_ptr is a map_cow() of fd */
+
+    uint32_t next_file; /* First file the guest has not read yet */
 } flash_t;
 
+/* Where flash_add_file() put each file, the same in every clone */
+typedef struct _flash_file {
+    const char  *name;
+    uint64_t    start;
+} flash_file;
+
+static flash_file *files;
+static uint32_t nr_files;
+
 static uint8_t *
 _flash_ptr(void *dev, uint64_t addr, size_t size)
 {
@@ -43,6 +55,22 @@ _flash_ptr(void *dev, uint64_t addr, size_t size)
     return (flash->mem_ptr + addr);
 }
 
+/* The guest got to a file it has not read before: a boot milestone */
+static void
+_file_reached(flash_t *flash, uint64_t addr)
+{
+    uint32_t i = flash->next_file;
+
+    if (i >= nr_files || addr < files[i].start)
+        return;
+
+    while (i + 1 < nr_files && addr >= files[i + 1].start)
+        i++;
+
+    bootphase_mark(files[i].name);
+    flash->next_file = i + 1;
+}
+
 static uint64_t
 flash_read(void *dev, uint64_t addr, size_t size, params_t params)
 {
@@ -50,6 +78,9 @@ flash_read(void *dev, uint64_t addr, size_t size, params_t params)
     if (ptr == NULL)
         return 0;
 
+    if (bootphase_on)
+        _file_reached((flash_t *) dev, addr);
+
     if (!IN_SAME_PAGE(addr, size))
         panic("%s: out of page boundary 0x%lx (0x%lx)\n",
               __func__, addr, size);
@@ -106,6 +137,20 @@ flash_write(void *dev, uint64_t addr, uint64_t data, size_t size,
     return ret;
 }
 
+static void
+flash_release(device_t *dev)
+{
+    flash_t *flash = (flash_t *) dev;
+
+    if (flash->mapped)
+        munmap(flash->mem_ptr, flash->mem_size);
+    else
+        free(flash->mem_ptr);
+
+    free(flash);
+}
+
+/* Without @parent_as the flash is only a template for flash_clone() */
 device_t *
 flash_init(address_space *parent_as)
 {
@@ -113,9 +158,11 @@ flash_init(address_space *parent_as)
 
     flash = calloc(1, sizeof(flash_t));
     flash->dev.name = "flash";
+    flash->dev.release = flash_release;
 
     flash->mem_size = FLASH_HEAD_SIZE;
     flash->mem_ptr = calloc(FLASH_HEAD_SIZE, 1);
+    flash->fd = -1;
 
     init_address_space(&(flash->dev.as),
                        FLASH_ADDRESS_SPACE_START,
@@ -126,7 +173,41 @@ flash_init(address_space *parent_as)
 
     flash->dev.as.device = flash;
 
-    register_address_space(parent_as, &(flash->dev.as));
+    if (parent_as)
+        register_address_space(parent_as, &(flash->dev.as));
+
+    return (device_t *) flash;
+}
+
+/* No more files, move the contents where flash_clone() can map them */
+void
+flash_seal(device_t *dev)
+{
+    flash_t *flash = (flash_t *) dev;
+
+    flash->fd = seal_buffer("flash", flash->mem_ptr, flash->mem_size);
+    free(flash->mem_ptr);
+
+    flash->mem_ptr = map_cow(flash->fd, flash->mem_size);
+    flash->mapped = true;
+}
+
+/* Pages are shared with @tmpl until the guest writes them */
+device_t *
+flash_clone(address_space *parent_as, device_t *tmpl)
+{
+    flash_t *src = (flash_t *) tmpl;
+    flash_t *flash;
+
+    if (src->fd < 0)
+        panic("%s: flash is not sealed\n", __func__);
+
+    flash = (flash_t *) flash_init(parent_as);
+    free(flash->mem_ptr);
+
+    flash->mem_size = src->mem_size;
+    flash->mem_ptr = map_cow(src->fd, src->mem_size);
+    flash->mapped = true;
 
     return (device_t *) flash;
 }
@@ -137,10 +218,16 @@ flash_add_file(device_t *dev, const char *filename)
     uint8_t *ptr;
     size_t size;
     struct stat info;
+    flash_file *file;
+    char name[256];
+    const char *base = strrchr(filename, '/');
     flash_t *flash = (flash_t *) dev;
 
     FILE *fp = fopen(filename, "rb");
 
+    if (flash->fd >= 0)
+        panic("%s: flash is sealed\n", __func__);
+
     if (fp == NULL || fstat(fileno(fp), &info) < 0)
         panic("%s: bad filename %s\n", __func__, filename);
 
@@ -168,6 +255,15 @@ flash_add_file(device_t *dev, const char *filename)
     printf("%s: add file %s [0x%lx - 0x%lx)\n",
            __func__, filename, flash->mem_size, size);
 
+    files = realloc(files, (nr_files + 1) * sizeof(flash_file));
+    if (files == NULL)
+        panic("%s: alloc memory failed!\n", __func__);
+
+    snprintf(name, sizeof(name), "flash %s", base ? base + 1 : filename);
+    file = &files[nr_files++];
+    file->name = strdup(name);
+    file->start = flash->mem_size;
+
     flash->mem_size = size;
 }
 
@@ -180,10 +276,16 @@ sort_func(const char *name, void *opaque)
     flash_add_file(dev, filename);
 }
 
+/* Module lists are global, machines on other threads wait their turn */
+static pthread_mutex_t modules_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 void
 flash_load_modules(device_t *dev)
 {
     flash_add_file(dev, "image/startup.bin");
+
+    pthread_mutex_lock(&modules_mutex);
     sort_modules(sort_func, dev);
     clear_modules();
+    pthread_mutex_unlock(&modules_mutex);
 }
@@ -0,0 +1,279 @@
+/*
+ * Flight recorder
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "flight.h"
+#include "util.h"
+#include "system_map.h"
+
+/* Records printed to stderr, the whole ring goes to the file */
+#define FLIGHT_TAIL     32
+
+/* Catches stray records from threads without a machine */
+static flight_rec spare_ring[FLIGHT_SIZE];
+
+__thread flight_rec *flight_ring = spare_ring;
+__thread uint32_t flight_head;
+
+static pthread_once_t signal_once = PTHREAD_ONCE_INIT;
+static int crashing;
+
+/*
+ * Everything below may run in a signal handler, on top of a malloc or
+ * stdio that held its lock: no stdio, lines are built by hand and go
+ * out with write(2).
+ */
+typedef struct _line_t {
+    char    buf[256];
+    size_t  len;
+} line_t;
+
+static void
+_str(line_t *l, const char *s)
+{
+    while (*s && l->len < sizeof(l->buf))
+        l->buf[l->len++] = *s++;
+}
+
+static void
+_num(line_t *l, uint64_t v, uint32_t base, uint32_t width)
+{
+    char tmp[24];
+    uint32_t n = 0;
+
+    do {
+        tmp[n++] = "0123456789abcdef"[v % base];
+        v /= base;
+    } while (v || n < width);
+
+    while (n && l->len < sizeof(l->buf))
+        l->buf[l->len++] = tmp[--n];
+}
+
+static void
+_hex(line_t *l, uint64_t v, uint32_t width)
+{
+    _str(l, "0x");
+    _num(l, v, 16, width);
+}
+
+static void
+_write(int fd, const char *buf, size_t len)
+{
+    ssize_t ret;
+
+    while (len) {
+        ret = write(fd, buf, len);
+        if (ret <= 0)
+            return;
+
+        buf += ret;
+        len -= (size_t)ret;
+    }
+}
+
+static void
+_flush(int fd, line_t *l)
+{
+    _write(fd, l->buf, l->len);
+    l->len = 0;
+}
+
+static void
+_print_addr(line_t *l, uint64_t addr)
+{
+    uint64_t start;
+    const char *name = lookup_system_map(addr, &start);
+
+    _hex(l, addr, 16);
+    if (name == NULL)
+        return;
+
+    _str(l, " <");
+    _str(l, name);
+    if (addr != start) {
+        _str(l, "+");
+        _hex(l, addr - start, 0);
+    }
+    _str(l, ">");
+}
+
+static void
+_print(int fd, const flight_rec *r)
+{
+    line_t l = { .len = 0 };
+
+    switch (r->kind)
+    {
+    case FLIGHT_JUMP:
+        _str(&l, "jump  ");
+        _print_addr(&l, r->pc);
+        _str(&l, " [");
+        if ((r->inst & 0x3) == 0x3)
+            _hex(&l, r->inst, 8);
+        else
+            _hex(&l, r->inst & 0xFFFF, 4);
+        _str(&l, "] -> ");
+        _print_addr(&l, r->a);
+        break;
+    case FLIGHT_TRAP:
+        _str(&l, "trap  ");
+        _print_addr(&l, r->pc);
+        _str(&l, " cause ");
+        _hex(&l, r->a, 0);
+        _str(&l, " tval ");
+        _hex(&l, r->b, 0);
+        break;
+    case FLIGHT_MMIO_READ:
+        _str(&l, "read  ");
+        _print_addr(&l, r->pc);
+        _str(&l, " ");
+        _num(&l, r->size, 10, 0);
+        _str(&l, " bytes at ");
+        _hex(&l, r->a, 0);
+        break;
+    case FLIGHT_MMIO_WRITE:
+        _str(&l, "write ");
+        _print_addr(&l, r->pc);
+        _str(&l, " ");
+        _num(&l, r->size, 10, 0);
+        _str(&l, " bytes at ");
+        _hex(&l, r->a, 0);
+        _str(&l, ": ");
+        _hex(&l, r->b, 0);
+        break;
+    default:
+        return;
+    }
+
+    /* A long symbol may have cut the line, it still ends */
+    if (l.len == sizeof(l.buf))
+        l.len--;
+    l.buf[l.len++] = '\n';
+    _flush(fd, &l);
+}
+
+void
+flight_dump(int fd, uint32_t count)
+{
+    uint32_t i;
+    uint32_t nr = flight_head < FLIGHT_SIZE ? flight_head : FLIGHT_SIZE;
+
+    if (count > nr)
+        count = nr;
+
+    for (i = flight_head - count; i != flight_head; i++)
+        _print(fd, &flight_ring[i & (FLIGHT_SIZE - 1)]);
+}
+
+void
+flight_crash(const char *why)
+{
+    int fd;
+    line_t l = { .len = 0 };
+    line_t filename = { .len = 0 };
+
+    /* A panic while dumping, or a second thread going down */
+    if (__atomic_exchange_n(&crashing, 1, __ATOMIC_SEQ_CST))
+        return;
+
+    if (flight_ring == spare_ring || flight_head == 0)
+        return;
+
+    _str(&l, "flight recorder, last ");
+    _num(&l, flight_head < FLIGHT_TAIL ? flight_head : FLIGHT_TAIL, 10, 0);
+    _str(&l, " of ");
+    _num(&l, flight_head, 10, 0);
+    _str(&l, " events (");
+    _str(&l, why);
+    _str(&l, "):\n");
+    _flush(STDERR_FILENO, &l);
+    flight_dump(STDERR_FILENO, FLIGHT_TAIL);
+
+    _str(&filename, "flight-");
+    _num(&filename, (uint64_t)getpid(), 10, 0);
+    _str(&filename, ".log");
+    filename.buf[filename.len] = '\0';
+
+    fd = open(filename.buf, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return;
+
+    flight_dump(fd, FLIGHT_SIZE);
+    close(fd);
+
+    _str(&l, "flight recorder: all events in ");
+    _str(&l, filename.buf);
+    _str(&l, "\n");
+    _flush(STDERR_FILENO, &l);
+}
+
+/* strsignal() is not async signal safe */
+static const char *
+_signal_name(int sig)
+{
+    switch (sig)
+    {
+    case SIGSEGV:   return "SIGSEGV";
+    case SIGBUS:    return "SIGBUS";
+    case SIGILL:    return "SIGILL";
+    case SIGFPE:    return "SIGFPE";
+    case SIGABRT:   return "SIGABRT";
+    default:        return "signal";
+    }
+}
+
+static void
+_signal(int sig)
+{
+    flight_crash(_signal_name(sig));
+
+    /* SA_RESETHAND put the default action back */
+    raise(sig);
+}
+
+static void
+_setup_signals(void)
+{
+    size_t i;
+    struct sigaction sa;
+    static const int sigs[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = _signal;
+    sa.sa_flags = (int)(SA_RESETHAND | SA_NODEFER);
+    sigemptyset(&sa.sa_mask);
+
+    for (i = 0; i < sizeof(sigs) / sizeof(sigs[0]); i++)
+        sigaction(sigs[i], &sa, NULL);
+}
+
+void
+flight_init(void)
+{
+    flight_ring = calloc(FLIGHT_SIZE, sizeof(flight_rec));
+    if (flight_ring == NULL)
+        panic("%s: alloc failed\n", __func__);
+
+    flight_head = 0;
+
+    pthread_once(&signal_once, _setup_signals);
+}
+
+void
+flight_exit(void)
+{
+    if (flight_ring != spare_ring)
+        free(flight_ring);
+
+    flight_ring = spare_ring;
+    flight_head = 0;
+}
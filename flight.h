@@ -0,0 +1,68 @@
+/*
+ * Flight recorder
+ *
+ * The last FLIGHT_SIZE events of a hart: taken jumps and branches,
+ * traps and mmio accesses. Always on; a record is a handful of stores
+ * into a thread local ring. Dumped by panic() and on fatal signals.
+ */
+
+#ifndef _FLIGHT_H_
+#define _FLIGHT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FLIGHT_SIZE         4096    /* Power of 2 */
+
+typedef enum {
+    FLIGHT_NONE = 0,
+    FLIGHT_JUMP,            /* a: target */
+    FLIGHT_TRAP,            /* a: cause, b: tval */
+    FLIGHT_MMIO_READ,       /* a: paddr */
+    FLIGHT_MMIO_WRITE,      /* a: paddr, b: data */
+} flight_kind;
+
+typedef struct _flight_rec {
+    uint64_t    pc;
+    uint64_t    a;
+    uint64_t    b;
+    uint32_t    inst;
+    uint8_t     kind;
+    uint8_t     size;
+} flight_rec;
+
+extern __thread flight_rec *flight_ring;
+extern __thread uint32_t flight_head;
+
+static inline flight_rec *
+flight_log(uint8_t kind, uint64_t pc, uint32_t inst, uint64_t a, uint64_t b)
+{
+    flight_rec *r = &flight_ring[flight_head++ & (FLIGHT_SIZE - 1)];
+
+    r->pc = pc;
+    r->a = a;
+    r->b = b;
+    r->inst = inst;
+    r->kind = kind;
+
+    return r;
+}
+
+void
+flight_init(void);
+
+void
+flight_exit(void);
+
+/* Oldest first, symbolized through System.map; async signal safe */
+void
+flight_dump(int fd, uint32_t count);
+
+/*
+ * On panic() or a fatal signal: the tail to stderr, all to a file.
+ * Async signal safe, @why must be too.
+ */
+void
+flight_crash(const char *why);
+
+#endif /* _FLIGHT_H_ */
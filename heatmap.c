@@ -0,0 +1,235 @@
+/*
+ * Heatmap
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "heatmap.h"
+#include "util.h"
+#include "isa.h"
+#include "device.h"
+#include "annotate.h"
+#include "system_map.h"
+
+#define HEAT_PAGE_SHIFT     12
+#define HEAT_HUGE_SHIFT     21
+#define HEAT_SYM_SPAN       (1UL << 20)
+
+/* Kernel text and data are linked at this offset from where they run */
+#define HEAT_VA_PA_OFFSET   (0xffffffe000000000UL - 0x80200000UL)
+
+typedef struct _heat_page {
+    uint64_t    fetch;
+    uint64_t    load;
+    uint64_t    store;
+} heat_page;
+
+typedef struct _heatmap_t {
+    const char  *filename;
+
+    /* Every page below the end of ram, untouched ones stay unbacked */
+    heat_page   *pages;
+    uint64_t    nr_pages;
+
+    uint64_t    last_fetch_page;
+    bool        block_start;
+    uint32_t    dumps;
+} heatmap_t;
+
+__thread bool heatmap_on;
+
+static __thread heatmap_t *heat;
+
+static inline heat_page *
+_page(uint64_t paddr)
+{
+    uint64_t pfn = paddr >> HEAT_PAGE_SHIFT;
+
+    return pfn < heat->nr_pages ? &heat->pages[pfn] : NULL;
+}
+
+void
+heatmap_record(uint64_t fetch, uint32_t opcode, uint64_t data, bool jumped)
+{
+    heat_page *p;
+    uint64_t fetch_page = fetch >> HEAT_PAGE_SHIFT;
+
+    if (heat->block_start || fetch_page != heat->last_fetch_page) {
+        if ((p = _page(fetch)))
+            p->fetch++;
+        heat->last_fetch_page = fetch_page;
+    }
+    heat->block_start = jumped;
+
+    if (data == ~0UL || (p = _page(data)) == NULL)
+        return;
+
+    switch (opcode)
+    {
+    case OP_LOAD:
+    case OP_LOAD_FP:
+        p->load++;
+        break;
+    case OP_STORE:
+    case OP_STORE_FP:
+        p->store++;
+        break;
+    case OP_AMO:
+        p->load++;
+        p->store++;
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * Symbol running into the end of the page, so a page where a function
+ * starts is named after it. Kernel symbols are virtual, bare payloads
+ * may have physical ones; a nearest symbol that far off is not it.
+ */
+static const char *
+_symbol(uint64_t paddr, uint64_t *start)
+{
+    const char *name;
+    uint64_t last = paddr + (1UL << HEAT_PAGE_SHIFT) - 1;
+
+    if (paddr >= RAM_ADDRESS_SPACE_START) {
+        name = lookup_system_map(last + HEAT_VA_PA_OFFSET, start);
+        if (name && last + HEAT_VA_PA_OFFSET - *start < HEAT_SYM_SPAN) {
+            *start -= HEAT_VA_PA_OFFSET;
+            return name;
+        }
+    }
+
+    name = lookup_system_map(last, start);
+    if (name && last - *start < HEAT_SYM_SPAN)
+        return name;
+
+    return NULL;
+}
+
+static void
+_dump(const char *why)
+{
+    uint64_t i;
+    uint64_t touched = 0;
+    uint64_t huge_pages = 0;
+    uint64_t huge_touched = 0;
+    uint64_t huge_count = 0;
+    uint64_t per_huge = 1UL << (HEAT_HUGE_SHIFT - HEAT_PAGE_SHIFT);
+    FILE *fp = fopen(heat->filename, heat->dumps++ ? "a" : "w");
+
+    if (fp == NULL) {
+        fprintf(stderr, "%s: cannot open %s\n", __func__, heat->filename);
+        return;
+    }
+
+    fprintf(fp, "== heatmap: %s\n", why);
+    fprintf(fp, "%-18s %10s %10s %10s  %s\n",
+            "page", "fetch", "load", "store", "symbol");
+
+    for (i = 0; i < heat->nr_pages; i++) {
+        uint64_t start = 0;
+        const char *sym;
+        heat_page *p = &heat->pages[i];
+        uint64_t paddr = i << HEAT_PAGE_SHIFT;
+
+        if (!p->fetch && !p->load && !p->store)
+            continue;
+
+        touched++;
+        sym = _symbol(paddr, &start);
+        fprintf(fp, "0x%016lx %10lu %10lu %10lu  ",
+                paddr, p->fetch, p->load, p->store);
+        if (sym && start <= paddr)
+            fprintf(fp, "%s+0x%lx\n", sym, paddr - start);
+        else if (sym)
+            fprintf(fp, "%s\n", sym);
+        else
+            fprintf(fp, "%s\n", is_mmio(paddr) ? "[mmio]" : "-");
+    }
+
+    /* How many 4K pages of each 2M region of ram are in use */
+    fprintf(fp, "\n%-18s %10s %14s\n", "2M region", "pages", "accesses");
+    for (i = RAM_ADDRESS_SPACE_START >> HEAT_PAGE_SHIFT; i < heat->nr_pages;
+         i++) {
+        heat_page *p = &heat->pages[i];
+        uint64_t n = p->fetch + p->load + p->store;
+
+        if (n) {
+            huge_touched++;
+            huge_count += n;
+        }
+
+        if ((i + 1) % per_huge == 0 || i + 1 == heat->nr_pages) {
+            if (huge_touched) {
+                fprintf(fp, "0x%016lx %6lu/%-3lu %14lu\n",
+                        (i & ~(per_huge - 1)) << HEAT_PAGE_SHIFT,
+                        huge_touched, per_huge, huge_count);
+                huge_pages++;
+            }
+            huge_touched = 0;
+            huge_count = 0;
+        }
+    }
+
+    fprintf(fp, "\n%lu pages, %lu 2M regions of ram touched\n\n",
+            touched, huge_pages);
+    fclose(fp);
+}
+
+static void
+_clear(void)
+{
+    memset(heat->pages, 0, heat->nr_pages * sizeof(heat_page));
+}
+
+static void
+_annotate(annotate_cmd cmd, uint64_t arg, void *opaque)
+{
+    char why[32];
+
+    if (cmd == ANNOTATE_ROI_BEGIN) {
+        _clear();
+    } else if (cmd == ANNOTATE_ROI_END) {
+        snprintf(why, sizeof(why), "roi %lu", arg);
+        _dump(why);
+    }
+}
+
+void
+heatmap_init(const char *filename, uint64_t mem_size)
+{
+    heatmap_on = false;
+    heat = NULL;
+
+    if (filename == NULL)
+        return;
+
+    heat = calloc(1, sizeof(heatmap_t));
+    heat->filename = filename;
+    heat->nr_pages = (RAM_ADDRESS_SPACE_START + mem_size) >> HEAT_PAGE_SHIFT;
+    heat->pages = calloc(heat->nr_pages, sizeof(heat_page));
+    if (heat->pages == NULL)
+        panic("%s: alloc failed\n", __func__);
+
+    annotate_register(_annotate, NULL);
+    heatmap_on = true;
+}
+
+void
+heatmap_exit(void)
+{
+    if (heat == NULL)
+        return;
+
+    _dump("exit");
+
+    free(heat->pages);
+    free(heat);
+    heat = NULL;
+    heatmap_on = false;
+}
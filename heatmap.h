@@ -0,0 +1,35 @@
+/*
+ * Heatmap
+ *
+ * Accesses per guest physical page, ram and mmio, split into fetch,
+ * load and store. Fetches are counted once per block, i.e. after a
+ * taken jump or on crossing into another page; loads and stores once
+ * per access. Only the instrumented run loop calls in.
+ */
+
+#ifndef _HEATMAP_H_
+#define _HEATMAP_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+extern __thread bool heatmap_on;
+
+/*
+ * One instruction retired. @fetch is the physical pc, @data the
+ * physical address of its load or store, ~0 if there was none.
+ */
+void
+heatmap_record(uint64_t fetch, uint32_t opcode, uint64_t data, bool jumped);
+
+/*
+ * Dump to @filename on exit, and at every ROI end; ROI begin clears
+ * the counts.
+ */
+void
+heatmap_init(const char *filename, uint64_t mem_size);
+
+void
+heatmap_exit(void);
+
+#endif /* _HEATMAP_H_ */
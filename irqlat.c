@@ -0,0 +1,229 @@
+/*
+ * Interrupt latency
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "irqlat.h"
+#include "util.h"
+#include "csr.h"
+#include "regfile.h"
+#include "metrics.h"
+
+#define IRQLAT_BUCKETS  48      /* Bucket i holds [2^(i-1), 2^i) */
+
+/* Only S and M mode take interrupts */
+#define IRQLAT_PRIVS    2
+
+typedef struct _irqlat_hist {
+    uint64_t    count;
+    uint64_t    sum;
+    uint64_t    max;
+    uint64_t    buckets[IRQLAT_BUCKETS];
+} irqlat_hist;
+
+struct _irqlat_t {
+    const char  *filename;
+    uint64_t    *icount;        /* Of the cpu thread */
+
+    /* Set by the source, 0 when nothing is pending */
+    int64_t     asserted_ns[IRQLAT_SOURCES];
+    uint64_t    asserted_icount[IRQLAT_SOURCES];
+
+    /* Written by the cpu thread only */
+    irqlat_hist ns[IRQLAT_SOURCES][IRQLAT_PRIVS];
+    irqlat_hist insns[IRQLAT_SOURCES][IRQLAT_PRIVS];
+};
+
+static const char *priv_names[IRQLAT_PRIVS] = { "S", "M" };
+
+static void
+_source_name(uint32_t src, char *buf, size_t size)
+{
+    if (src == IRQLAT_SOFT)
+        snprintf(buf, size, "msip");
+    else if (src == IRQLAT_TIMER)
+        snprintf(buf, size, "timer");
+    else
+        snprintf(buf, size, "plic-%u", src - IRQLAT_PLIC(0));
+}
+
+void
+_irqlat_assert(irqlat_t *lat, uint32_t src)
+{
+    int64_t none = 0;
+    int64_t now = get_clock();
+
+    if (__atomic_load_n(&lat->asserted_ns[src], __ATOMIC_RELAXED))
+        return;
+
+    lat->asserted_icount[src] = __atomic_load_n(lat->icount,
+                                                __ATOMIC_RELAXED);
+    __atomic_compare_exchange_n(&lat->asserted_ns[src], &none, now, false,
+                                __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+void
+_irqlat_clear(irqlat_t *lat, uint32_t src)
+{
+    __atomic_store_n(&lat->asserted_ns[src], 0, __ATOMIC_RELAXED);
+}
+
+static void
+_add(irqlat_hist *h, uint64_t v)
+{
+    uint32_t i = v ? (uint32_t)(64 - __builtin_clzl(v)) : 0;
+
+    if (i >= IRQLAT_BUCKETS)
+        i = IRQLAT_BUCKETS - 1;
+
+    h->buckets[i]++;
+    h->count++;
+    h->sum += v;
+    if (v > h->max)
+        h->max = v;
+}
+
+void
+_irqlat_taken(irqlat_t *lat, uint32_t src, uint32_t priv)
+{
+    uint32_t p = (priv == M_MODE) ? 1 : 0;
+    int64_t ns = __atomic_exchange_n(&lat->asserted_ns[src], 0,
+                                     __ATOMIC_ACQUIRE);
+
+    /* Taken before, and still asserted */
+    if (ns == 0)
+        return;
+
+    _add(&lat->ns[src][p], (uint64_t)(get_clock() - ns));
+    _add(&lat->insns[src][p], *lat->icount - lat->asserted_icount[src]);
+}
+
+static void
+_dump_hist(FILE *fp, const char *unit, const irqlat_hist *h)
+{
+    uint32_t i;
+
+    fprintf(fp, "  %-5s mean %10.0f  max %10lu  |", unit,
+            (double)h->sum / (double)h->count, h->max);
+
+    for (i = 0; i < IRQLAT_BUCKETS; i++) {
+        if (h->buckets[i])
+            fprintf(fp, " <2^%u:%lu", i, h->buckets[i]);
+    }
+    fputc('\n', fp);
+}
+
+static void
+_dump(irqlat_t *lat)
+{
+    uint32_t src;
+    uint32_t p;
+    FILE *fp = report_open(lat->filename);
+
+    if (fp == NULL)
+        return;
+
+    fprintf(fp, "== irq latency, assert to trap\n");
+
+    for (src = 0; src < IRQLAT_SOURCES; src++) {
+        for (p = 0; p < IRQLAT_PRIVS; p++) {
+            char name[16];
+
+            if (!lat->ns[src][p].count)
+                continue;
+
+            _source_name(src, name, sizeof(name));
+            fprintf(fp, "%s -> %s: %lu taken\n", name, priv_names[p],
+                    lat->ns[src][p].count);
+            _dump_hist(fp, "ns", &lat->ns[src][p]);
+            _dump_hist(fp, "insns", &lat->insns[src][p]);
+        }
+    }
+
+    report_close(fp);
+}
+
+static void
+_write_family(FILE *out, irqlat_t *lat, const char *family, bool ns)
+{
+    uint32_t src;
+    uint32_t p;
+    uint32_t i;
+
+    fprintf(out, "# HELP %s Interrupt assert to trap entry.\n"
+            "# TYPE %s histogram\n", family, family);
+
+    for (src = 0; src < IRQLAT_SOURCES; src++) {
+        for (p = 0; p < IRQLAT_PRIVS; p++) {
+            char name[16];
+            uint64_t count = 0;
+            irqlat_hist *h = ns ? &lat->ns[src][p] : &lat->insns[src][p];
+
+            if (!h->count)
+                continue;
+
+            _source_name(src, name, sizeof(name));
+            for (i = 0; i < IRQLAT_BUCKETS; i++) {
+                /* Bucket i ends below 2^i */
+                count += h->buckets[i];
+                fprintf(out, "%s_bucket{source=\"%s\",priv=\"%s\",le=\"%g\"} "
+                        "%lu\n", family, name, priv_names[p],
+                        ns ? (double)(1UL << i) * 1e-9 : (double)(1UL << i),
+                        count);
+            }
+            fprintf(out, "%s_bucket{source=\"%s\",priv=\"%s\",le=\"+Inf\"} "
+                    "%lu\n", family, name, priv_names[p], h->count);
+            fprintf(out, "%s_sum{source=\"%s\",priv=\"%s\"} %g\n",
+                    family, name, priv_names[p],
+                    ns ? (double)h->sum * 1e-9 : (double)h->sum);
+            fprintf(out, "%s_count{source=\"%s\",priv=\"%s\"} %lu\n",
+                    family, name, priv_names[p], h->count);
+        }
+    }
+}
+
+static void
+_write_metrics(FILE *out, void *opaque)
+{
+    _write_family(out, opaque, "xemu_irq_latency_seconds", true);
+    _write_family(out, opaque, "xemu_irq_latency_instructions", false);
+}
+
+void
+irqlat_init(const char *filename)
+{
+    irqlat_t *lat;
+
+    _machine->irqlat = NULL;
+
+    if (filename == NULL)
+        return;
+
+    lat = calloc(1, sizeof(irqlat_t));
+    if (lat == NULL)
+        panic("%s: alloc failed\n", __func__);
+
+    lat->filename = filename;
+    lat->icount = &_insn_count;
+
+    metrics_register(_write_metrics, lat);
+
+    _machine->irqlat = lat;
+}
+
+void
+irqlat_exit(void)
+{
+    irqlat_t *lat = _machine->irqlat;
+
+    if (lat == NULL)
+        return;
+
+    _machine->irqlat = NULL;
+
+    _dump(lat);
+    free(lat);
+}
@@ -0,0 +1,65 @@
+/*
+ * Interrupt latency
+ *
+ * Time from an interrupt being asserted by its source to the trap that
+ * takes it, per source and target privilege, as log2 histograms in
+ * host nanoseconds and in guest instructions. Off unless irqlat_init()
+ * is given a file; the sources then pay one test of _machine->irqlat.
+ */
+
+#ifndef _IRQLAT_H_
+#define _IRQLAT_H_
+
+#include <stdint.h>
+
+#include "machine.h"
+
+/* Sources: msip, the clint timer and the plic ids */
+#define IRQLAT_SOFT         0
+#define IRQLAT_TIMER        1
+#define IRQLAT_PLIC(id)     (2 + (id))
+#define IRQLAT_SOURCES      IRQLAT_PLIC(128)
+
+typedef struct _irqlat_t irqlat_t;
+
+void
+_irqlat_assert(irqlat_t *lat, uint32_t src);
+
+void
+_irqlat_clear(irqlat_t *lat, uint32_t src);
+
+void
+_irqlat_taken(irqlat_t *lat, uint32_t src, uint32_t priv);
+
+/* Raised, from any thread of the machine; the first one counts */
+static inline void
+irqlat_assert(uint32_t src)
+{
+    if (_machine->irqlat)
+        _irqlat_assert(_machine->irqlat, src);
+}
+
+/* Dropped by the source before the cpu took it */
+static inline void
+irqlat_clear(uint32_t src)
+{
+    if (_machine->irqlat)
+        _irqlat_clear(_machine->irqlat, src);
+}
+
+/* On the cpu thread, when a trap is entered for @src */
+static inline void
+irqlat_taken(uint32_t src, uint32_t priv)
+{
+    if (_machine->irqlat)
+        _irqlat_taken(_machine->irqlat, src, priv);
+}
+
+/* Dump to @filename ("-" for stderr) on exit */
+void
+irqlat_init(const char *filename);
+
+void
+irqlat_exit(void);
+
+#endif /* _IRQLAT_H_ */
@@ -0,0 +1,688 @@
+/*
+ * Machine
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "machine.h"
+#include "util.h"
+#include "decode.h"
+#include "execute.h"
+#include "csr.h"
+#include "trap.h"
+#include "regfile.h"
+#include "system_map.h"
+#include "virtio.h"
+#include "trace.h"
+#include "boot.h"
+#include "fdt.h"
+#include "request.h"
+#include "snapshot.h"
+#include "coverage.h"
+#include "replay.h"
+#include "control.h"
+#include "annotate.h"
+#include "profile.h"
+#include "stats.h"
+#include "btrace.h"
+#include "flight.h"
+#include "timeline.h"
+#include "metrics.h"
+#include "mmu.h"
+#include "irqlat.h"
+#include "heatmap.h"
+#include "bootphase.h"
+#include "bios/bios.h"
+
+#define VIRTIO_MMIO_AS_START_0  0x0000000010001000UL
+#define VIRTIO_MMIO_AS_END_0    0x0000000010001FFFUL
+
+typedef struct _thread_start {
+    machine_t   *m;
+    const char  *name;
+    void        *(*routine)(void *);
+    void        *arg;
+} thread_start;
+
+__thread machine_t *_machine;
+
+__thread uint64_t _pc;
+__thread uint64_t _insn_count;
+
+/* Of the machine being created, read when its modules are sorted */
+__thread const char *_startpoint;
+
+/* Thread locals of the cpu thread, for the metrics thread to read */
+typedef struct _cpu_metrics {
+    machine_t   *m;
+    uint64_t    *icount;
+    uint64_t    *walks;
+    uint64_t    *pte_reads;
+    uint64_t    (*traps)[16];
+
+    /* Previous scrape, for the MIPS gauge */
+    int64_t     last_ns;
+    uint64_t    last_icount;
+} cpu_metrics;
+
+static __thread cpu_metrics *metrics;
+
+static pthread_once_t setup_once = PTHREAD_ONCE_INIT;
+static pthread_once_t images_once = PTHREAD_ONCE_INIT;
+
+/* Sealed rom and flash contents, every machine maps a private copy */
+static device_t *rom_template;
+static device_t *flash_template;
+
+/* Tables shared by all machines, read only once set up */
+static void
+_setup(void)
+{
+    setup_system_map();
+    setup_trace_table();
+}
+
+/*
+ * Images are read, and modules sorted, once per process. The startpoint
+ * of the first machine decides which modules go into flash.
+ */
+static void
+_load_images(void)
+{
+    rom_template = rom_init(NULL);
+    rom_add_file(rom_template, "image/bios.bin", 0);
+    rom_add_file(rom_template, "image/virt.dtb", 0x100);
+    rom_add_file(rom_template, "image/fw_jump.bin", 0x2000);
+    rom_seal(rom_template);
+
+    flash_template = flash_init(NULL);
+    flash_load_modules(flash_template);
+    flash_seal(flash_template);
+}
+
+void
+machine_config_init(machine_config *cfg)
+{
+    memset(cfg, 0, sizeof(machine_config));
+
+    cfg->mem_size = RAM_SIZE_DEFAULT;
+    cfg->firmware = "image/fw_jump.bin";
+    cfg->kernel = "image/startup.bin";
+    cfg->kernel_addr = PAYLOAD_LINK_ADDR;
+    cfg->profile_period = 10000;
+}
+
+static void
+_check(machine_t *m, const char *caller)
+{
+    if (m != _machine)
+        panic("%s: machine %p is not on this thread\n", caller, m);
+}
+
+static void *
+_thread_entry(void *opaque)
+{
+    thread_start start = *(thread_start *) opaque;
+
+    free(opaque);
+
+    _machine = start.m;
+    timeline_thread(start.name);
+    metrics_thread(start.name);
+
+    return start.routine(start.arg);
+}
+
+void
+machine_thread_create(pthread_t *tid, const char *name,
+                      void *(*routine)(void *), void *arg)
+{
+    thread_start *start = calloc(1, sizeof(thread_start));
+    start->m = _machine;
+    start->name = name;
+    start->routine = routine;
+    start->arg = arg;
+
+    if (pthread_create(tid, NULL, _thread_entry, start))
+        panic("%s: cannot create thread\n", __func__);
+}
+
+static void
+_write_metrics(FILE *out, void *opaque)
+{
+    uint32_t i;
+    uint32_t j;
+    address_space *as;
+    cpu_metrics *cm = opaque;
+    uint64_t icount = *cm->icount;
+    int64_t now = get_clock();
+
+    fprintf(out, "# HELP xemu_instructions_retired_total "
+            "Guest instructions retired.\n"
+            "# TYPE xemu_instructions_retired_total counter\n"
+            "xemu_instructions_retired_total %lu\n", icount);
+
+    fprintf(out, "# HELP xemu_mips "
+            "Million instructions per second since the last scrape.\n"
+            "# TYPE xemu_mips gauge\n"
+            "xemu_mips %.3f\n",
+            now > cm->last_ns ?
+            (double)(icount - cm->last_icount) * 1e3 /
+            (double)(now - cm->last_ns) : 0.0);
+    cm->last_ns = now;
+    cm->last_icount = icount;
+
+    fprintf(out, "# HELP xemu_page_walks_total "
+            "Sv39 translations; there is no TLB, each one walks.\n"
+            "# TYPE xemu_page_walks_total counter\n"
+            "xemu_page_walks_total %lu\n"
+            "# HELP xemu_pte_reads_total Page table entries read by walks.\n"
+            "# TYPE xemu_pte_reads_total counter\n"
+            "xemu_pte_reads_total %lu\n", *cm->walks, *cm->pte_reads);
+
+    fprintf(out, "# HELP xemu_traps_total Traps taken, by cause.\n"
+            "# TYPE xemu_traps_total counter\n");
+    for (i = 0; i < 2; i++) {
+        for (j = 0; j < 16; j++) {
+            if (cm->traps[i][j])
+                fprintf(out, "xemu_traps_total{type=\"%s\",cause=\"%u\"} "
+                        "%lu\n", i ? "interrupt" : "exception", j,
+                        cm->traps[i][j]);
+        }
+    }
+
+    fprintf(out, "# HELP xemu_mmio_reads_total Guest reads, by device.\n"
+            "# TYPE xemu_mmio_reads_total counter\n");
+    for (as = cm->m->root_as.children; as; as = as->sibling) {
+        device_t *dev = (device_t *) as->device;
+        if (dev->mmio_reads)
+            fprintf(out, "xemu_mmio_reads_total{device=\"%s\",base=\"0x%lx\"} "
+                    "%lu\n", dev->name, as->start, dev->mmio_reads);
+    }
+
+    fprintf(out, "# HELP xemu_mmio_writes_total Guest writes, by device.\n"
+            "# TYPE xemu_mmio_writes_total counter\n");
+    for (as = cm->m->root_as.children; as; as = as->sibling) {
+        device_t *dev = (device_t *) as->device;
+        if (dev->mmio_writes)
+            fprintf(out, "xemu_mmio_writes_total{device=\"%s\",base=\"0x%lx\"} "
+                    "%lu\n", dev->name, as->start, dev->mmio_writes);
+    }
+}
+
+static void
+_init_metrics(machine_t *m)
+{
+    metrics = calloc(1, sizeof(cpu_metrics));
+    metrics->m = m;
+    metrics->icount = &_insn_count;
+    metrics->walks = &mmu_walks;
+    metrics->pte_reads = &mmu_pte_reads;
+    metrics->traps = metrics_traps;
+    metrics->last_ns = get_clock();
+
+    mmu_walks = 0;
+    mmu_pte_reads = 0;
+    memset(metrics_traps, 0, sizeof(metrics_traps));
+
+    metrics_register(_write_metrics, metrics);
+    metrics_thread("cpu");
+}
+
+static void
+_stop_request(void *opaque)
+{
+    ((machine_t *) opaque)->stopped = true;
+}
+
+machine_t *
+machine_create(const machine_config *cfg)
+{
+    uint32_t i;
+    machine_t *m;
+
+    if (_machine)
+        panic("%s: this thread has a machine already\n", __func__);
+
+    pthread_once(&setup_once, _setup);
+
+    m = calloc(1, sizeof(machine_t));
+    _machine = m;
+
+    /* Thread local state may be left over from a previous machine */
+    memset(reg, 0, sizeof(reg));
+    memset(freg, 0, sizeof(freg));
+    _pc = ROM_BASE;
+    _insn_count = 0;
+    request_init();
+    coverage_reset();
+    annotate_init();
+    flight_init();
+    timeline_thread("cpu");
+    _init_metrics(m);
+
+    _startpoint = cfg->startpoint;
+    pthread_once(&images_once, _load_images);
+
+    /* Init root address space */
+    init_address_space(&m->root_as,
+                       ROOT_ADDRESS_SPACE_START,
+                       ROOT_ADDRESS_SPACE_END);
+
+    /* Init CSR */
+    csr_init();
+
+    cpu_enable_clock();
+
+    /* Before devices, their threads may raise interrupts at once */
+    irqlat_init(cfg->irq_latency);
+    bootphase_init(cfg->boot_report);
+
+    rtc_init(&m->root_as);
+    sifive_test_init(&m->root_as);
+    pci_host_init(&m->root_as);
+
+    m->plic = plic_init(&m->root_as);
+    clint_init(&m->root_as);
+
+    m->rom = rom_clone(&m->root_as, rom_template);
+    m->flash = flash_clone(&m->root_as, flash_template);
+
+    m->ram = ram_init(&m->root_as, cfg->mem_size, cfg->mem_path,
+                      cfg->ram_flags);
+
+    /* Let the guest see the real size of ram */
+    fdt_fixup_memory(rom_ptr(m->rom, DTB_LOAD_ADDR - ROM_BASE, DTB_SIZE_MAX),
+                     DTB_SIZE_MAX, RAM_ADDRESS_SPACE_START, cfg->mem_size);
+
+    uart_init(&m->root_as, 0xa, cfg->uart_input, cfg->console);
+
+    for (i = 0; i < 8; i++) {
+        device_t *vdev;
+        vdev = virtio_mmio_init(&m->root_as,
+                                VIRTIO_MMIO_AS_START_0 + i * 0x1000,
+                                VIRTIO_MMIO_AS_END_0 + i * 0x1000);
+
+        if (i == 0 && cfg->drive) {
+            virtio_dev_t *blk = virtio_blk_init(cfg->drive, i + 1);
+            virtio_set_backend(vdev, blk);
+        }
+    }
+
+    snapshot_init(m->ram);
+    snapshot_register("cpu.reg", reg, sizeof(reg), NULL, NULL);
+    snapshot_register("cpu.freg", freg, sizeof(freg), NULL, NULL);
+    snapshot_register("cpu.pc", &_pc, sizeof(_pc), NULL, NULL);
+    snapshot_register("cpu.icount", &_insn_count, sizeof(_insn_count),
+                      NULL, NULL);
+
+    m->stop_req = request_register(_stop_request, m);
+
+    profile_init(cfg->profile, cfg->profile_period, cfg->profile_host_time);
+    stats_init(cfg->stats);
+    btrace_init(cfg->trace);
+    trace_init(cfg->trace_points);
+    heatmap_init(cfg->heatmap, cfg->mem_size);
+
+    if (cfg->snapshot)
+        snapshot_load(cfg->snapshot, cfg->snapshot_lazy);
+    else if (cfg->direct_boot)
+        _pc = boot_direct(m->ram, cfg->firmware, cfg->kernel,
+                          cfg->kernel_addr);
+
+    return m;
+}
+
+void
+machine_destroy(machine_t *m)
+{
+    address_space *as;
+
+    _check(m, __func__);
+
+    control_detach(m);
+    metrics_detach(m);
+    bootphase_exit();
+    profile_exit();
+    stats_exit();
+    btrace_exit();
+    trace_exit();
+    heatmap_exit();
+    /* Lazy restore threads write to ram, stop them before it goes */
+    snapshot_exit();
+
+    /* Devices stop their threads before they go */
+    as = m->root_as.children;
+    while (as) {
+        address_space *next = as->sibling;
+        device_t *dev = (device_t *) as->device;
+
+        if (dev->release)
+            dev->release(dev);
+        else
+            free(dev);
+
+        as = next;
+    }
+
+    irqlat_exit();
+    annotate_exit();
+
+    free(metrics);
+    metrics = NULL;
+    flight_exit();
+
+    _machine = NULL;
+    free(m);
+}
+
+static uint64_t
+fetch(address_space *as, uint32_t *inst)
+{
+    uint32_t lo;
+    uint32_t hi;
+
+    bool has_except = false;
+
+    if ((_pc + 2) & (PAGE_SIZE - 1UL)) {
+        *inst = (uint32_t)as_read(as, _pc, 4, 0, &has_except);
+        if (has_except)
+            return raise_except(_pc, CAUSE_INST_PAGE_FAULT, _pc);
+
+        return 0;
+    }
+
+    lo = (uint32_t)as_read(as, _pc, 2, 0, &has_except);
+    if (has_except)
+        return raise_except(_pc, CAUSE_INST_PAGE_FAULT, _pc);
+
+    hi = (uint32_t)as_read(as, _pc + 2, 2, 0, &has_except);
+    if (has_except)
+        return raise_except(_pc, CAUSE_INST_PAGE_FAULT, (_pc + 2));
+
+    *inst = ((hi << 16) | lo);
+    return 0;
+}
+
+/* Hooks that cost a test per instruction are left to the instrumented loop */
+static inline bool
+_instrumented(void)
+{
+    return trace_on || stats_on || btrace_on || heatmap_on ||
+        profile_icount != ~0UL;
+}
+
+/*
+ * The loop is built twice, with @instrumented constant. It returns to
+ * machine_run() when a request turns the hooks on or off.
+ */
+static inline __attribute__((always_inline)) void
+_run(machine_t *m, uint64_t end, const bool instrumented)
+{
+    address_space *as = &m->root_as;
+
+    while (_insn_count < end) {
+        op_t      op;
+        uint32_t  rd;
+        uint32_t  rs1;
+        uint32_t  rs2;
+        uint64_t  imm;
+        uint32_t  csr_addr;
+        uint32_t  opcode;
+        uint64_t  ticks = 0;
+        uint64_t  addr = 0;
+        uint64_t  fall_pc;
+        uint64_t  fetch_paddr = 0;
+        uint64_t  traps = 0;
+
+        uint64_t next_pc = 0;
+        uint32_t inst = 0;
+
+        if (_pc < 0x1000)
+            panic("%s: bad pc 0x%lx\n", __func__, _pc);
+
+        if (request_pending()) {
+            request_handle();
+            if (m->stopped || _instrumented() != instrumented)
+                break;
+        }
+
+        next_pc = handle_interrupt(_pc);
+        if (next_pc) {
+            /* An interrupt occurs */
+            _pc = next_pc;
+            continue;
+        }
+
+        /* Fetch */
+        next_pc = fetch(as, &inst);
+        if (next_pc) {
+            /* An except occurs during fetch */
+            _pc = next_pc;
+            continue;
+        }
+
+        if (instrumented && stats_on)
+            ticks = (uint64_t)cpu_get_host_ticks();
+
+        /* Left by fetch(), execute() sets it again for loads and stores */
+        if (instrumented && (heatmap_on || stats_on)) {
+            fetch_paddr = as_last_paddr;
+            as_last_paddr = ~0UL;
+        }
+
+        /* Decode */
+        next_pc = decode(_pc, inst, &op, &rd, &rs1, &rs2, &imm,
+                         &csr_addr, &opcode);
+
+        if (instrumented && btrace_on) {
+            addr = btrace_addr(opcode, rs1, imm);
+            traps = trap_count;
+        }
+
+        /* Execute */
+        fall_pc = next_pc;
+        next_pc = execute(as, _pc, next_pc,
+                          op, rd, rs1, rs2, imm, csr_addr);
+
+        /* Once per block, for the flight recorder and boot milestones */
+        if (next_pc != fall_pc) {
+            flight_log(FLIGHT_JUMP, _pc, inst, next_pc, 0);
+            bootphase_jump(next_pc);
+        }
+
+        if (instrumented) {
+            if (stats_on)
+                stats_retire(op, (uint64_t)cpu_get_host_ticks() - ticks);
+
+            /* A trapped one runs again after the handler, if at all */
+            if (btrace_on && trap_count == traps)
+                btrace_record(_pc, inst, opcode, rd, addr);
+
+            if (trace_on)
+                trace(_pc, op, rd, rs1, rs2, imm, csr_addr, opcode, inst);
+
+            if (heatmap_on)
+                heatmap_record(fetch_paddr, opcode, as_last_paddr,
+                               next_pc != fall_pc);
+        }
+
+        _pc = next_pc;
+
+        if (++_insn_count >= replay_icount)
+            replay_checkpoint();
+
+        if (instrumented && _insn_count >= profile_icount)
+            profile_sample();
+    }
+}
+
+static void
+_run_plain(machine_t *m, uint64_t end)
+{
+    _run(m, end, false);
+}
+
+static void
+_run_instrumented(machine_t *m, uint64_t end)
+{
+    _run(m, end, true);
+}
+
+uint64_t
+machine_run(machine_t *m, uint64_t n_insns)
+{
+    uint64_t start;
+    uint64_t end;
+
+    _check(m, __func__);
+
+    start = _insn_count;
+    end = n_insns ? start + n_insns : ~0UL;
+    m->stopped = false;
+    m->exit_reason = MACHINE_EXIT_NONE;
+    m->exit_code = 0;
+
+    bootphase_start(_pc);
+
+    while (!m->stopped && _insn_count < end) {
+        if (_instrumented())
+            _run_instrumented(m, end);
+        else
+            _run_plain(m, end);
+    }
+
+    /* Keeps a reason set on the last instruction, e.g. by the finisher */
+    if (!m->stopped)
+        machine_finish(m, MACHINE_EXIT_LIMIT, 0);
+    else
+        machine_finish(m, MACHINE_EXIT_STOP, 0);
+
+    /* Nothing left to stop the next run, our own stop request included */
+    request_handle();
+
+    return _insn_count - start;
+}
+
+uint64_t
+machine_step(machine_t *m)
+{
+    machine_run(m, 1);
+    return _pc;
+}
+
+void
+machine_stop(machine_t *m)
+{
+    __atomic_or_fetch(&m->requests, m->stop_req, __ATOMIC_SEQ_CST);
+}
+
+void
+machine_finish(machine_t *m, machine_exit_t reason, uint32_t code)
+{
+    machine_exit_t none = MACHINE_EXIT_NONE;
+
+    if (__atomic_compare_exchange_n(&m->exit_reason, &none, reason, false,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        m->exit_code = code;
+
+    machine_stop(m);
+}
+
+const char *
+machine_exit_name(machine_exit_t reason)
+{
+    static const char *names[] = {
+        [MACHINE_EXIT_NONE]     = "none",
+        [MACHINE_EXIT_LIMIT]    = "insn limit",
+        [MACHINE_EXIT_STOP]     = "stopped",
+        [MACHINE_EXIT_TIMEOUT]  = "timeout",
+        [MACHINE_EXIT_PASS]     = "pass",
+        [MACHINE_EXIT_FAIL]     = "fail",
+        [MACHINE_EXIT_RESET]    = "reset",
+    };
+
+    return names[reason];
+}
+
+uint64_t
+machine_get_pc(machine_t *m)
+{
+    _check(m, __func__);
+    return _pc;
+}
+
+void
+machine_set_pc(machine_t *m, uint64_t pc)
+{
+    _check(m, __func__);
+    _pc = pc;
+}
+
+uint64_t
+machine_get_reg(machine_t *m, uint32_t index)
+{
+    _check(m, __func__);
+    return (index < REG_LIMIT) ? reg[index] : 0;
+}
+
+void
+machine_set_reg(machine_t *m, uint32_t index, uint64_t val)
+{
+    _check(m, __func__);
+    if (index && index < REG_LIMIT)
+        reg[index] = val;
+}
+
+uint64_t
+machine_icount(machine_t *m)
+{
+    _check(m, __func__);
+    return _insn_count;
+}
+
+static bool
+_in_ram(machine_t *m, uint64_t addr, size_t size)
+{
+    return addr >= RAM_ADDRESS_SPACE_START &&
+        addr + size <= RAM_ADDRESS_SPACE_START + ram_size(m->ram) &&
+        addr + size >= addr;
+}
+
+int
+machine_read_mem(machine_t *m, uint64_t addr, void *buf, size_t size)
+{
+    if (!_in_ram(m, addr, size))
+        return -1;
+
+    memcpy(buf, ram_ptr(m->ram, addr, size), size);
+    return 0;
+}
+
+/* Through ram_write(), so that dirty pages are tracked */
+int
+machine_write_mem(machine_t *m, uint64_t addr, const void *buf, size_t size)
+{
+    const uint8_t *data = buf;
+
+    _check(m, __func__);
+
+    if (!_in_ram(m, addr, size))
+        return -1;
+
+    while (size) {
+        uint64_t val = 0;
+        size_t len = (size >= 8 && !(addr % 8)) ? 8 : 1;
+
+        memcpy(&val, data, len);
+        as_write_nommu(&m->root_as, addr, len, val, 0);
+
+        addr += len;
+        data += len;
+        size -= len;
+    }
+
+    return 0;
+}
@@ -0,0 +1,174 @@
+/*
+ * Machine
+ *
+ * A whole virt board: cpu, devices and ram. This is the interface of
+ * libxemu, the xemu binary is one user of it.
+ *
+ * Cpu state is thread local, so a machine belongs to the thread that
+ * created it: run, step, the accessors and destroy must be called on
+ * that thread, and a thread holds at most one machine at a time. Many
+ * machines run side by side on different threads. Device threads of a
+ * machine are bound to it in the same way.
+ */
+
+#ifndef _MACHINE_H_
+#define _MACHINE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "types.h"
+#include "address_space.h"
+#include "device.h"
+
+typedef struct _machine_config {
+    uint64_t    mem_size;
+    uint32_t    ram_flags;      /* RAM_F_* */
+    const char  *mem_path;
+
+    const char  *drive;         /* Image for virtio-blk, NULL for none */
+    bool        uart_input;     /* Feed stdin to the guest console */
+    const char  *console;       /* File for console output, NULL for stdout */
+    const char  *startpoint;    /* First kernel module to load */
+
+    bool        direct_boot;
+    const char  *firmware;      /* NULL for none */
+    const char  *kernel;
+    uint64_t    kernel_addr;
+
+    const char  *snapshot;      /* Start from this snapshot instead */
+    bool        snapshot_lazy;
+
+    const char  *profile;       /* Folded stacks output, NULL for none */
+    uint64_t    profile_period; /* Instructions, or us with host time */
+    bool        profile_host_time;
+
+    const char  *stats;         /* Instruction mix, "-" for stderr */
+    const char  *trace;         /* Binary instruction trace */
+    const char  *irq_latency;   /* Latency histograms, "-" for stderr */
+    const char  *heatmap;       /* Accesses per physical page */
+    const char  *boot_report;   /* Boot milestones, "-" for stderr */
+    bool        trace_points;   /* Start with trace.yml points on */
+} machine_config;
+
+/* Why machine_run() returned */
+typedef enum {
+    MACHINE_EXIT_NONE = 0,
+    MACHINE_EXIT_LIMIT,         /* Retired the instructions asked for */
+    MACHINE_EXIT_STOP,          /* machine_stop() */
+    MACHINE_EXIT_TIMEOUT,       /* Stopped by a watchdog of the caller */
+    MACHINE_EXIT_PASS,          /* Guest powered off, test finisher */
+    MACHINE_EXIT_FAIL,          /* Guest reported failure, see exit_code */
+    MACHINE_EXIT_RESET,         /* Guest asked for a reboot */
+} machine_exit_t;
+
+typedef struct _machine_t {
+    address_space   root_as;
+
+    /* Shared with device and control threads */
+    volatile uint32_t requests;
+    int64_t         clock_offset;
+    int64_t         clock_saved;
+    device_t        *plic;
+    struct _irqlat_t *irqlat;   /* NULL unless measured */
+
+    device_t        *rom;
+    device_t        *flash;
+    device_t        *ram;
+
+    bool            stopped;
+    uint32_t        stop_req;
+
+    machine_exit_t  exit_reason;
+    uint32_t        exit_code;
+} machine_t;
+
+/* Machine of the calling thread */
+extern __thread machine_t *_machine;
+
+void
+machine_config_init(machine_config *cfg);
+
+machine_t *
+machine_create(const machine_config *cfg);
+
+void
+machine_destroy(machine_t *m);
+
+/*
+ * Run until @n_insns instructions retire (0 for no limit) or until
+ * machine_stop(). Returns the number of instructions retired.
+ */
+uint64_t
+machine_run(machine_t *m, uint64_t n_insns);
+
+/* Retire one instruction, returns the new pc */
+uint64_t
+machine_step(machine_t *m);
+
+/* Can be called from any thread */
+void
+machine_stop(machine_t *m);
+
+/*
+ * Stop with @reason, unless a reason is set already. Can be called
+ * from any thread.
+ */
+void
+machine_finish(machine_t *m, machine_exit_t reason, uint32_t code);
+
+const char *
+machine_exit_name(machine_exit_t reason);
+
+#define MACHINE_STATUS_TIMEOUT  124     /* As timeout(1) */
+
+/*
+ * Process exit status for a run that ended with @reason. exit() keeps
+ * the low 8 bits only, a guest fail code of 0x100 must not turn to 0.
+ */
+static inline int
+machine_exit_status(machine_exit_t reason, uint32_t code)
+{
+    switch (reason)
+    {
+    case MACHINE_EXIT_FAIL:
+        return (code & 0xff) ? (int)(code & 0xff) : 1;
+    case MACHINE_EXIT_TIMEOUT:
+        return MACHINE_STATUS_TIMEOUT;
+    default:
+        return 0;
+    }
+}
+
+uint64_t
+machine_get_pc(machine_t *m);
+
+void
+machine_set_pc(machine_t *m, uint64_t pc);
+
+uint64_t
+machine_get_reg(machine_t *m, uint32_t index);
+
+void
+machine_set_reg(machine_t *m, uint32_t index, uint64_t val);
+
+uint64_t
+machine_icount(machine_t *m);
+
+/* Access guest ram by physical address, -1 if out of ram */
+int
+machine_read_mem(machine_t *m, uint64_t addr, void *buf, size_t size);
+
+int
+machine_write_mem(machine_t *m, uint64_t addr, const void *buf, size_t size);
+
+/*
+ * For devices: start a thread bound to the current machine. @name
+ * labels it in the timeline and metrics.
+ */
+void
+machine_thread_create(pthread_t *tid, const char *name,
+                      void *(*routine)(void *), void *arg);
+
+#endif /* _MACHINE_H_ */
@@ -0,0 +1,235 @@
+/*
+ * Metrics
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "metrics.h"
+#include "control.h"
+#include "util.h"
+#include "list.h"
+
+typedef struct _metrics_collector {
+    list_head   entry;
+    metrics_cb  cb;
+    void        *opaque;
+    machine_t   *m;
+} metrics_collector;
+
+typedef struct _metrics_thread_t {
+    list_head   entry;
+    const char  *name;
+    clockid_t   clock;
+    machine_t   *m;
+} metrics_thread_t;
+
+__thread uint64_t metrics_traps[2][16];
+
+static LIST_HEAD(collectors);
+static LIST_HEAD(threads);
+static pthread_mutex_t metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static bool listening;
+static machine_t *owner;       /* Machine the collectors belong to */
+
+void
+metrics_register(metrics_cb cb, void *opaque)
+{
+    metrics_collector *c;
+
+    if (!listening)
+        return;
+
+    pthread_mutex_lock(&metrics_mutex);
+
+    if (control_own(&owner)) {
+        c = calloc(1, sizeof(metrics_collector));
+        c->cb = cb;
+        c->opaque = opaque;
+        c->m = _machine;
+        list_add_tail(&c->entry, &collectors);
+    }
+
+    pthread_mutex_unlock(&metrics_mutex);
+}
+
+void
+metrics_thread(const char *name)
+{
+    metrics_thread_t *t;
+
+    if (!listening)
+        return;
+
+    pthread_mutex_lock(&metrics_mutex);
+
+    if (control_own(&owner)) {
+        t = calloc(1, sizeof(metrics_thread_t));
+        t->name = name;
+        t->m = _machine;
+        if (pthread_getcpuclockid(pthread_self(), &t->clock))
+            free(t);
+        else
+            list_add_tail(&t->entry, &threads);
+    }
+
+    pthread_mutex_unlock(&metrics_mutex);
+}
+
+void
+metrics_detach(machine_t *m)
+{
+    list_head *pos;
+    list_head *n;
+
+    if (!listening)
+        return;
+
+    pthread_mutex_lock(&metrics_mutex);
+
+    list_for_each_safe(pos, n, &collectors) {
+        metrics_collector *c = list_entry(pos, metrics_collector, entry);
+        if (c->m == m) {
+            list_del(pos);
+            free(c);
+        }
+    }
+
+    list_for_each_safe(pos, n, &threads) {
+        metrics_thread_t *t = list_entry(pos, metrics_thread_t, entry);
+        if (t->m == m) {
+            list_del(pos);
+            free(t);
+        }
+    }
+
+    if (owner == m)
+        owner = NULL;
+
+    pthread_mutex_unlock(&metrics_mutex);
+}
+
+static void
+_write_threads(FILE *out)
+{
+    metrics_thread_t *t;
+
+    fprintf(out, "# HELP xemu_thread_cpu_seconds_total "
+            "Host cpu time of emulator threads.\n"
+            "# TYPE xemu_thread_cpu_seconds_total counter\n");
+
+    list_for_each_entry(t, &threads, entry) {
+        struct timespec ts;
+
+        /* Gone already if its device was released */
+        if (clock_gettime(t->clock, &ts))
+            continue;
+
+        fprintf(out, "xemu_thread_cpu_seconds_total{thread=\"%s\"} %ld.%09ld\n",
+                t->name, ts.tv_sec, ts.tv_nsec);
+    }
+}
+
+static void
+_scrape(FILE *out)
+{
+    metrics_collector *c;
+
+    /* Held over the callbacks, the machine may be going away */
+    pthread_mutex_lock(&metrics_mutex);
+
+    list_for_each_entry(c, &collectors, entry)
+        c->cb(out, c->opaque);
+
+    _write_threads(out);
+
+    pthread_mutex_unlock(&metrics_mutex);
+}
+
+/* -1 once the scraper has gone, MSG_NOSIGNAL keeps that an EPIPE */
+static int
+_send(int conn, const char *buf, size_t len)
+{
+    while (len) {
+        ssize_t n = send(conn, buf, len, MSG_NOSIGNAL);
+        if (n < 0)
+            return -1;
+
+        buf += n;
+        len -= (size_t)n;
+    }
+
+    return 0;
+}
+
+static void *
+_routine(void *arg)
+{
+    int sock = (int)(intptr_t)arg;
+
+    while (1) {
+        FILE *out;
+        char *body;
+        size_t len;
+        char req[512];
+        char hdr[128];
+        int ret = 0;
+        ssize_t n = 0;
+        struct pollfd pfd;
+        int conn = accept(sock, NULL, NULL);
+        if (conn < 0)
+            continue;
+
+        /* An http client sends a request first, a plain one may not */
+        pfd.fd = conn;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 100) > 0)
+            n = read(conn, req, sizeof(req) - 1);
+        req[n > 0 ? n : 0] = '\0';
+
+        out = open_memstream(&body, &len);
+        if (out == NULL)
+            panic("%s: open_memstream failed\n", __func__);
+
+        _scrape(out);
+        fclose(out);
+
+        if (!strncmp(req, "GET ", 4)) {
+            snprintf(hdr, sizeof(hdr), "HTTP/1.0 200 OK\r\n"
+                     "Content-Type: text/plain; version=0.0.4\r\n"
+                     "Content-Length: %zu\r\n\r\n", len);
+            ret = _send(conn, hdr, strlen(hdr));
+        }
+
+        /* Nothing to do about a scraper that went away */
+        if (ret == 0)
+            _send(conn, body, len);
+
+        free(body);
+        close(conn);
+    }
+
+    return NULL;
+}
+
+void
+metrics_init(const char *path)
+{
+    int sock;
+    pthread_t tid;
+
+    sock = control_listen(path);
+
+    listening = true;
+
+    pthread_create(&tid, NULL, _routine, (void *)(intptr_t)sock);
+
+    printf("%s: listen on %s\n", __func__, path);
+}
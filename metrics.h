@@ -0,0 +1,43 @@
+/*
+ * Metrics
+ *
+ * Live counters in Prometheus text format on a unix socket, e.g.
+ * curl --unix-socket PATH http://xemu/metrics. Counters are plain
+ * fields written by one thread each; they are only read, and summed
+ * up, when the socket is scraped.
+ */
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "machine.h"
+
+/* Taken traps of this hart, [interrupt][cause] */
+extern __thread uint64_t metrics_traps[2][16];
+
+/* Writes metric families to @out, on the metrics thread */
+typedef void (*metrics_cb)(FILE *out, void *opaque);
+
+/*
+ * A no-op unless metrics_init() was called. Like control commands,
+ * collectors belong to the first machine that registers one.
+ */
+void
+metrics_register(metrics_cb cb, void *opaque);
+
+/* Account the cpu time of the calling thread under @name */
+void
+metrics_thread(const char *name);
+
+/* Call before machine_create() */
+void
+metrics_init(const char *path);
+
+/* Drop collectors and threads of @m */
+void
+metrics_detach(machine_t *m);
+
+#endif /* _METRICS_H_ */
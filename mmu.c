@@ -12,6 +12,8 @@
 #define PTE_W(pte) BIT(pte, 2)
 #define PTE_X(pte) BIT(pte, 3)
 
+__thread uint64_t mmu_walks;
+__thread uint64_t mmu_pte_reads;
 
 int
 mmu(address_space *as, uint64_t vaddr, uint64_t *paddr)
@@ -28,10 +30,12 @@ mmu(address_space *as, uint64_t vaddr, uint64_t *paddr)
     }
 
     root_ppn = BITS(csr_read(SATP, &has_except), 43, 0);
+    mmu_walks++;
 
     /* Level-2 */
     *paddr = (root_ppn << 12) | (BITS(vaddr, 38, 30) << 3);
     pte = as_read_nommu(as, *paddr, 8, 0);
+    mmu_pte_reads++;
 
     if ((PTE_V(pte) == 0) || ((PTE_R(pte) == 0) && (PTE_W(pte) == 1))) {
         /* page-fault */
@@ -47,6 +51,7 @@ mmu(address_space *as, uint64_t vaddr, uint64_t *paddr)
     /* Level-1 */
     *paddr = (BITS(pte, 53, 10) << 12) | (BITS(vaddr, 29, 21) << 3);
     pte = as_read_nommu(as, *paddr, 8, 0);
+    mmu_pte_reads++;
 
     if ((PTE_V(pte) == 0) || ((PTE_R(pte) == 0) && (PTE_W(pte) == 1))) {
         /* page-fault */
@@ -62,6 +67,7 @@ mmu(address_space *as, uint64_t vaddr, uint64_t *paddr)
     /* Level-0 */
     *paddr = (BITS(pte, 53, 10) << 12) | (BITS(vaddr, 20, 12) << 3);
     pte = as_read_nommu(as, *paddr, 8, 0);
+    mmu_pte_reads++;
 
     if ((PTE_V(pte) == 0) || ((PTE_R(pte) == 0) && (PTE_W(pte) == 1))) {
         /* page-fault */
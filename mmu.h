@@ -9,6 +9,10 @@
 
 #include "address_space.h"
 
+/* There is no TLB: every translation with paging on walks the table */
+extern __thread uint64_t mmu_walks;
+extern __thread uint64_t mmu_pte_reads;
+
 int
 mmu(address_space *as, uint64_t vaddr, uint64_t *paddr);
 
@@ -13,7 +13,7 @@
 
 #define PAGE_OFFSET 0xffffffe000000000UL
 
-extern const char *_startpoint;
+extern __thread const char *_startpoint;
 
 static LIST_HEAD(modules);
 
@@ -8,6 +8,7 @@
 #include "device.h"
 #include "util.h"
 #include "pci.h"
+#include "snapshot.h"
 
 #define PCI_HOST_ADDRESS_SPACE_START 0x0000000030000000
 #define PCI_HOST_ADDRESS_SPACE_END   0x000000003FFFFFFF
@@ -145,5 +146,9 @@ pci_host_init(address_space *parent_as)
 
     register_address_space(parent_as, &(pci_host->dev.as));
 
+    snapshot_register("pci_host", &pci_host->command,
+                      sizeof(pci_host_t) - offsetof(pci_host_t, command),
+                      NULL, NULL);
+
     return (device_t *) pci_host;
 }
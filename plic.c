@@ -9,7 +9,13 @@
 #include "address_space.h"
 #include "device.h"
 #include "util.h"
+#include "timeline.h"
+#include "metrics.h"
+#include "irqlat.h"
+#include "probes.h"
 #include "csr.h"
+#include "snapshot.h"
+#include "machine.h"
 
 #define PLIC_ADDRESS_SPACE_START 0x000000000C000000
 #define PLIC_ADDRESS_SPACE_END   0x000000000C20FFFF
@@ -23,6 +29,9 @@ typedef struct _plic_t
 
     pthread_mutex_t _mutex;
 
+    /* Not in the snapshot, which starts at priority */
+    uint64_t signals[NUM_SOURCES + 1];
+
     uint32_t priority[NUM_SOURCES + 1];
 
     uint32_t mpt;       /* M-Mode priority threshold */
@@ -37,7 +46,6 @@ typedef struct _plic_t
     uint32_t pending[5];
 } plic_t;
 
-plic_t *plic;   /* Global plic */
 
 
 static void
@@ -55,15 +63,21 @@ plic_signal(uint32_t id)
 {
     uint32_t index;
     uint32_t offset;
+    plic_t *plic = (plic_t *) _machine->plic;
 
     if (id == 0)
         panic("%s: interrupt number cannot be 0\n", __func__);
 
+    timeline_instant("plic signal", "irq", id);
+
     _bit_pos(id, &index, &offset);
 
     pthread_mutex_lock(&plic->_mutex);
+    plic->signals[id]++;
     plic->pending[index] |= (1U << offset);
     pthread_mutex_unlock(&plic->_mutex);
+
+    irqlat_assert(IRQLAT_PLIC(id));
 }
 
 static void
@@ -71,6 +85,7 @@ clear_pending_bit(uint32_t id)
 {
     uint32_t index;
     uint32_t offset;
+    plic_t *plic = (plic_t *) _machine->plic;
 
     if (id == 0)
         panic("%s: interrupt number cannot be 0\n", __func__);
@@ -101,6 +116,7 @@ plic_read(void *dev, uint64_t addr, size_t size, params_t params)
             panic("%s: bad claim mcc(%u)\n", __func__, plic->mcc);
 
         clear_pending_bit(plic->mcc);
+        PROBE2(plic_claim, plic->mcc, M_MODE);
         return plic->mcc;
     }
 
@@ -111,6 +127,7 @@ plic_read(void *dev, uint64_t addr, size_t size, params_t params)
         //panic("%s: bad claim scc(%u)\n", __func__, plic->scc);
 
         clear_pending_bit(plic->scc);
+        PROBE2(plic_claim, plic->scc, S_MODE);
         return plic->scc;
     }
 
@@ -163,6 +180,7 @@ plic_write(void *dev, uint64_t addr, uint64_t data, size_t size,
             panic("%s: bad complete (%u, %u)\n",
                   __func__, plic->mcc, (uint32_t) data);
 
+        PROBE2(plic_complete, plic->mcc, M_MODE);
         plic->mcc = 0;
         return 0;
     }
@@ -173,6 +191,7 @@ plic_write(void *dev, uint64_t addr, uint64_t data, size_t size,
             panic("%s: bad complete (%u, %u)\n",
                   __func__, plic->scc, (uint32_t) data);
 
+        PROBE2(plic_complete, plic->scc, S_MODE);
         plic->scc = 0;
         return 0;
     }
@@ -183,9 +202,28 @@ plic_write(void *dev, uint64_t addr, uint64_t data, size_t size,
     return 0;
 }
 
+static void
+_write_metrics(FILE *out, void *opaque)
+{
+    uint32_t id;
+    plic_t *plic = opaque;
+
+    fprintf(out, "# HELP xemu_plic_signals_total "
+            "Interrupts raised, by source.\n"
+            "# TYPE xemu_plic_signals_total counter\n");
+
+    for (id = 1; id <= NUM_SOURCES; id++) {
+        if (plic->signals[id])
+            fprintf(out, "xemu_plic_signals_total{source=\"%u\"} %lu\n",
+                    id, plic->signals[id]);
+    }
+}
+
 device_t *
 plic_init(address_space *parent_as)
 {
+    plic_t *plic;
+
     plic = calloc(1, sizeof(plic_t));
     plic->dev.name = "plic";
 
@@ -202,6 +240,11 @@ plic_init(address_space *parent_as)
 
     register_address_space(parent_as, &(plic->dev.as));
 
+    snapshot_register("plic", plic->priority,
+                      sizeof(plic_t) - offsetof(plic_t, priority), NULL, NULL);
+
+    metrics_register(_write_metrics, plic);
+
     return (device_t *) plic;
 }
 
@@ -227,6 +270,7 @@ plic_interrupt(void)
 {
     uint32_t i;
     uint32_t ret = 0;
+    plic_t *plic = (plic_t *) _machine->plic;
 
     uint32_t next_priv = intr_next_priv(EXTERNAL_INTR_TYPE, priv());
 
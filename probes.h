@@ -0,0 +1,109 @@
+/*
+ * Static probes
+ *
+ * USDT probes under the provider "xemu" for bpftrace, perf probe and
+ * systemtap, e.g.
+ *
+ *      bpftrace -e 'usdt:./xemu:xemu:trap_enter { @[arg2] = count(); }'
+ *
+ * A probe is a nop in the code and a note in .note.stapsdt naming it
+ * and where its arguments live; nothing runs unless a tracer attaches.
+ * With <sys/sdt.h> the probes come from there. Without it, x86_64 and
+ * aarch64 hosts emit the same notes here, other hosts get no probes.
+ *
+ *  trap_enter      pc, cause, tval, next priv
+ *  trap_exit       return pc
+ *  mmio_read       paddr, size, data
+ *  mmio_write      paddr, size, data
+ *  vq_pop          descriptor head, bytes for the device to write
+ *  vq_complete     descriptor head, bytes written
+ *  plic_claim      irq, priv
+ *  plic_complete   irq, priv
+ *  tlb_flush       vaddr, asid (sfence.vma operands)
+ *  timer_fire      mtimecmp
+ */
+
+#ifndef _PROBES_H_
+#define _PROBES_H_
+
+#include <stdint.h>
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define HAVE_SYS_SDT
+#endif
+#endif
+
+#if defined(HAVE_SYS_SDT)
+
+#include <sys/sdt.h>
+
+#define PROBE1(name, a) \
+    DTRACE_PROBE1(xemu, name, a)
+#define PROBE2(name, a, b) \
+    DTRACE_PROBE2(xemu, name, a, b)
+#define PROBE3(name, a, b, c) \
+    DTRACE_PROBE3(xemu, name, a, b, c)
+#define PROBE4(name, a, b, c, d) \
+    DTRACE_PROBE4(xemu, name, a, b, c, d)
+
+#elif defined(__x86_64__) || defined(__aarch64__)
+
+/*
+ * Version 3 stapsdt notes as <sys/sdt.h> writes them. Arguments are
+ * all passed as 64 bits, "8@" plus wherever the compiler keeps them.
+ */
+#define _PROBE_BASE                                                     \
+    ".ifndef _.stapsdt.base\n"                                          \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+    ".weak _.stapsdt.base\n"                                            \
+    ".hidden _.stapsdt.base\n"                                          \
+    "_.stapsdt.base: .space 1\n"                                        \
+    ".size _.stapsdt.base, 1\n"                                         \
+    ".popsection\n"                                                     \
+    ".endif\n"
+
+#define _PROBE(name, args, ...)                                         \
+    __asm__ __volatile__ (                                              \
+        "990: nop\n"                                                    \
+        ".pushsection .note.stapsdt,\"?\",\"note\"\n"                   \
+        ".balign 4\n"                                                   \
+        ".4byte 992f-991f, 994f-993f, 3\n"                              \
+        "991: .asciz \"stapsdt\"\n"                                     \
+        "992: .balign 4\n"                                              \
+        "993: .8byte 990b\n"                                            \
+        ".8byte _.stapsdt.base\n"                                       \
+        ".8byte 0\n"                                                    \
+        ".asciz \"xemu\"\n"                                             \
+        ".asciz \"" #name "\"\n"                                        \
+        ".asciz \"" args "\"\n"                                         \
+        "994: .balign 4\n"                                              \
+        ".popsection\n"                                                 \
+        _PROBE_BASE                                                     \
+        :: __VA_ARGS__)
+
+#define PROBE1(name, a)                                                 \
+    _PROBE(name, "8@%[a1]",                                             \
+           [a1] "nor" ((uint64_t)(a)))
+#define PROBE2(name, a, b)                                              \
+    _PROBE(name, "8@%[a1] 8@%[a2]",                                     \
+           [a1] "nor" ((uint64_t)(a)), [a2] "nor" ((uint64_t)(b)))
+#define PROBE3(name, a, b, c)                                           \
+    _PROBE(name, "8@%[a1] 8@%[a2] 8@%[a3]",                             \
+           [a1] "nor" ((uint64_t)(a)), [a2] "nor" ((uint64_t)(b)),      \
+           [a3] "nor" ((uint64_t)(c)))
+#define PROBE4(name, a, b, c, d)                                        \
+    _PROBE(name, "8@%[a1] 8@%[a2] 8@%[a3] 8@%[a4]",                     \
+           [a1] "nor" ((uint64_t)(a)), [a2] "nor" ((uint64_t)(b)),      \
+           [a3] "nor" ((uint64_t)(c)), [a4] "nor" ((uint64_t)(d)))
+
+#else
+
+#define PROBE1(name, a)             do { } while (0)
+#define PROBE2(name, a, b)          do { } while (0)
+#define PROBE3(name, a, b, c)       do { } while (0)
+#define PROBE4(name, a, b, c, d)    do { } while (0)
+
+#endif
+
+#endif /* _PROBES_H_ */
@@ -0,0 +1,288 @@
+/*
+ * Profile
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "profile.h"
+#include "util.h"
+#include "mmu.h"
+#include "regfile.h"
+#include "machine.h"
+#include "request.h"
+#include "system_map.h"
+
+#define PROFILE_HASH_INIT   1024
+
+/* Frames hold symbol start addresses, or the pc if no symbol covers it */
+typedef struct _prof_stack {
+    uint64_t    count;
+    uint32_t    depth;
+    uint64_t    *frames;    /* Leaf first */
+} prof_stack;
+
+typedef struct _profile_t {
+    const char  *filename;
+    uint64_t    period;
+    bool        host_time;
+
+    prof_stack  *stacks;    /* Open addressing, keyed by frames */
+    size_t      nr_slots;
+    size_t      nr_stacks;
+    uint64_t    nr_samples;
+
+    pthread_t   tid;
+    bool        exiting;
+    uint32_t    sample_req;
+} profile_t;
+
+__thread uint64_t profile_icount = ~0UL;
+
+static __thread profile_t *prof;
+
+static uint64_t
+_hash(const uint64_t *frames, uint32_t depth)
+{
+    uint32_t i;
+    uint64_t h = 0xcbf29ce484222325UL;
+
+    for (i = 0; i < depth; i++) {
+        h ^= frames[i];
+        h *= 0x100000001b3UL;
+    }
+
+    return h;
+}
+
+static prof_stack *
+_find(prof_stack *stacks, size_t nr_slots, const uint64_t *frames,
+      uint32_t depth)
+{
+    size_t i = _hash(frames, depth) & (nr_slots - 1);
+
+    while (stacks[i].frames) {
+        if (stacks[i].depth == depth &&
+            !memcmp(stacks[i].frames, frames, depth * sizeof(uint64_t)))
+            break;
+
+        i = (i + 1) & (nr_slots - 1);
+    }
+
+    return &stacks[i];
+}
+
+static void
+_grow(void)
+{
+    size_t i;
+    size_t nr_slots = prof->nr_slots * 2;
+    prof_stack *stacks = calloc(nr_slots, sizeof(prof_stack));
+
+    if (stacks == NULL)
+        panic("%s: alloc failed\n", __func__);
+
+    for (i = 0; i < prof->nr_slots; i++) {
+        prof_stack *old = &prof->stacks[i];
+        if (old->frames)
+            *_find(stacks, nr_slots, old->frames, old->depth) = *old;
+    }
+
+    free(prof->stacks);
+    prof->stacks = stacks;
+    prof->nr_slots = nr_slots;
+}
+
+/* Guest virtual address to host, only for ram that is mapped */
+static bool
+_read_guest(uint64_t vaddr, uint64_t *val)
+{
+    uint64_t paddr;
+    device_t *ram = _machine->ram;
+
+    if ((vaddr & 7) || mmu(&_machine->root_as, vaddr, &paddr) < 0)
+        return false;
+
+    if (paddr < RAM_ADDRESS_SPACE_START ||
+        paddr - RAM_ADDRESS_SPACE_START > ram_size(ram) - 8)
+        return false;
+
+    memcpy(val, ram_ptr(ram, paddr, 8), 8);
+    return true;
+}
+
+static uint64_t
+_symbolize(uint64_t addr)
+{
+    uint64_t start;
+
+    if (lookup_system_map(addr, &start))
+        return start;
+
+    return addr;
+}
+
+void
+profile_sample(void)
+{
+    prof_stack *stack;
+    uint32_t depth = 0;
+    uint64_t frames[PROFILE_DEPTH_MAX];
+    uint64_t fp = reg[REG_S0];
+
+    if (!prof->host_time)
+        profile_icount = _insn_count + prof->period;
+
+    frames[depth++] = _symbolize(_pc);
+
+    while (depth < PROFILE_DEPTH_MAX) {
+        uint64_t ra;
+        uint64_t prev;
+
+        if (!_read_guest(fp - 8, &ra) || !_read_guest(fp - 16, &prev) ||
+            ra == 0)
+            break;
+
+        /* Inside the call, not at the instruction after it */
+        frames[depth++] = _symbolize(ra - 1);
+
+        /* The stack grows down, callers live above */
+        if (prev <= fp)
+            break;
+
+        fp = prev;
+    }
+
+    if ((prof->nr_stacks + 1) * 2 > prof->nr_slots)
+        _grow();
+
+    stack = _find(prof->stacks, prof->nr_slots, frames, depth);
+    if (stack->frames == NULL) {
+        stack->frames = malloc(depth * sizeof(uint64_t));
+        memcpy(stack->frames, frames, depth * sizeof(uint64_t));
+        stack->depth = depth;
+        prof->nr_stacks++;
+    }
+
+    stack->count++;
+    prof->nr_samples++;
+}
+
+static void
+_sample_request(void *opaque)
+{
+    if (prof)
+        profile_sample();
+}
+
+static void *
+_routine(void *opaque)
+{
+    profile_t *p = opaque;
+
+    while (!__atomic_load_n(&p->exiting, __ATOMIC_ACQUIRE)) {
+        usleep((useconds_t)p->period);
+        request_post(p->sample_req);
+    }
+
+    return NULL;
+}
+
+void
+profile_init(const char *filename, uint64_t period, bool host_time)
+{
+    profile_icount = ~0UL;
+    prof = NULL;
+
+    if (filename == NULL)
+        return;
+
+    if (period == 0)
+        panic("%s: bad period\n", __func__);
+
+    prof = calloc(1, sizeof(profile_t));
+    prof->filename = filename;
+    prof->period = period;
+    prof->host_time = host_time;
+
+    prof->nr_slots = PROFILE_HASH_INIT;
+    prof->stacks = calloc(prof->nr_slots, sizeof(prof_stack));
+
+    if (host_time) {
+        prof->sample_req = request_register(_sample_request, NULL);
+        machine_thread_create(&prof->tid, "profile", _routine, prof);
+    } else {
+        profile_icount = _insn_count + period;
+    }
+}
+
+static void
+_print_frame(FILE *fp, uint64_t addr)
+{
+    uint64_t start;
+    const char *name = lookup_system_map(addr, &start);
+
+    if (name && start == addr)
+        fprintf(fp, "%s", name);
+    else
+        fprintf(fp, "0x%lx", addr);
+}
+
+static void
+_write(void)
+{
+    size_t i;
+    FILE *fp = fopen(prof->filename, "w");
+
+    if (fp == NULL) {
+        fprintf(stderr, "%s: cannot open %s\n", __func__, prof->filename);
+        return;
+    }
+
+    for (i = 0; i < prof->nr_slots; i++) {
+        uint32_t j;
+        prof_stack *stack = &prof->stacks[i];
+
+        if (stack->frames == NULL)
+            continue;
+
+        /* Root first */
+        for (j = stack->depth; j > 0; j--) {
+            _print_frame(fp, stack->frames[j - 1]);
+            fputc(j > 1 ? ';' : ' ', fp);
+        }
+        fprintf(fp, "%lu\n", stack->count);
+    }
+
+    fclose(fp);
+
+    fprintf(stderr, "profile: %lu samples, %lu stacks to %s\n",
+            prof->nr_samples, prof->nr_stacks, prof->filename);
+}
+
+void
+profile_exit(void)
+{
+    size_t i;
+
+    if (prof == NULL)
+        return;
+
+    if (prof->host_time) {
+        __atomic_store_n(&prof->exiting, true, __ATOMIC_RELEASE);
+        pthread_join(prof->tid, NULL);
+    }
+
+    _write();
+
+    for (i = 0; i < prof->nr_slots; i++)
+        free(prof->stacks[i].frames);
+
+    free(prof->stacks);
+    free(prof);
+    prof = NULL;
+    profile_icount = ~0UL;
+}
@@ -0,0 +1,38 @@
+/*
+ * Profile
+ *
+ * Samples the guest pc and call stack, every so many instructions or
+ * host microseconds, and writes folded stacks for flamegraph.pl:
+ *
+ *      caller;callee;leaf count
+ *
+ * Stacks are unwound through frame pointers, as code built with
+ * -fno-omit-frame-pointer lays them out: ra at fp - 8 and the caller's
+ * fp at fp - 16. A leaf function that saves no ra loses its caller.
+ */
+
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PROFILE_DEPTH_MAX   64
+
+/* Next sample is due when _insn_count reaches this */
+extern __thread uint64_t profile_icount;
+
+/*
+ * Start sampling every @period instructions, or every @period host
+ * microseconds with @host_time. Writes @filename on profile_exit().
+ */
+void
+profile_init(const char *filename, uint64_t period, bool host_time);
+
+void
+profile_exit(void);
+
+void
+profile_sample(void);
+
+#endif /* _PROFILE_H_ */
@@ -2,14 +2,20 @@
  * RAM
  */
 
+#define _GNU_SOURCE
+#include <stdlib.h>
 #include <malloc.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "device.h"
 #include "address_space.h"
 #include "util.h"
+#include "control.h"
 
-#define RAM_ADDRESS_SPACE_START 0x0000000080000000UL
-#define RAM_ADDRESS_SPACE_END   0x00000000FFFFFFFFUL
+#define HUGE_PAGE_SIZE  (2UL << 20)
 
 typedef struct _ram_t
 {
@@ -17,8 +23,37 @@ typedef struct _ram_t
 
     uint8_t *mem_ptr;
     size_t  mem_size;
+
+    int     fd;         /* -1 unless ram is shared */
+
+    uint64_t *dirty;    /* Bitmap of written pages, NULL if not tracked */
 } ram_t;
 
+/*
+ * The cpu and the virtio-blk worker both write ram. Only a clear bit
+ * takes the atomic, stores to a page already dirty stay cheap.
+ */
+static inline void
+_set_dirty(ram_t *ram, uint64_t page)
+{
+    uint64_t *word = &ram->dirty[page >> 6];
+    uint64_t bit = 1UL << (page & 63);
+
+    if (!(__atomic_load_n(word, __ATOMIC_RELAXED) & bit))
+        __atomic_fetch_or(word, bit, __ATOMIC_RELAXED);
+}
+
+static inline void
+_mark_dirty(ram_t *ram, uint64_t addr, size_t size)
+{
+    uint64_t first = addr >> PAGE_SHIFT;
+    uint64_t last = (addr + size - 1) >> PAGE_SHIFT;
+
+    _set_dirty(ram, first);
+    if (last != first)
+        _set_dirty(ram, last);
+}
+
 static uint64_t
 ram_read(void *dev, uint64_t addr, size_t size, params_t params)
 {
@@ -149,23 +184,272 @@ ram_write(void *dev, uint64_t addr, uint64_t data, size_t size,
         data = _amo32((uint32_t)ret, (uint32_t)data, params);
 
     memcpy(ram->mem_ptr + addr, &data, size);
+
+    if (ram->dirty)
+        _mark_dirty(ram, addr, size);
+
     return ret;
 }
 
+uint8_t *
+ram_ptr(device_t *dev, uint64_t addr, size_t size)
+{
+    ram_t *ram = (ram_t *) dev;
+
+    /* No addr + size, it wraps for sizes out of a bad elf */
+    if (addr < ram->dev.as.start || size > ram->mem_size ||
+        addr - ram->dev.as.start > ram->mem_size - size) {
+        panic("%s: [0x%lx, 0x%lx) out of ram\n",
+              __func__, addr, addr + size);
+    }
+
+    return ram->mem_ptr + (addr - ram->dev.as.start);
+}
+
+/*
+ * Guest ram is reserved but not committed, so pages that the guest
+ * never touches cost nothing on the host.
+ */
+static uint8_t *
+_ram_alloc(size_t size, uint32_t flags)
+{
+    void *ptr;
+    int mflags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+
+    if (flags & RAM_F_HUGETLB) {
+        ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   mflags | MAP_HUGETLB, -1, 0);
+        if (ptr == MAP_FAILED)
+            panic("%s: no hugetlb pages for 0x%lx\n", __func__, size);
+
+        return ptr;
+    }
+
+    ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, mflags, -1, 0);
+    if (ptr == MAP_FAILED)
+        panic("%s: mmap 0x%lx failed\n", __func__, size);
+
+    /* Transparent huge pages, only a hint. */
+    madvise(ptr, size, MADV_HUGEPAGE);
+
+    return ptr;
+}
+
+/*
+ * Shared backing: a memfd, or a file under @mem_path. A directory
+ * (e.g. a hugetlbfs mount) gets an unlinked temporary file.
+ */
+static int
+_ram_open(const char *mem_path, size_t size, uint32_t flags)
+{
+    int fd;
+    struct stat info;
+
+    if (mem_path == NULL) {
+        unsigned int mfd_flags = MFD_CLOEXEC;
+        if (flags & RAM_F_HUGETLB)
+            mfd_flags |= MFD_HUGETLB;
+
+        fd = memfd_create("xemu-ram", mfd_flags);
+    } else if (stat(mem_path, &info) == 0 && S_ISDIR(info.st_mode)) {
+        char filename[256];
+        snprintf(filename, sizeof(filename), "%s/xemu-ram.XXXXXX", mem_path);
+        fd = mkostemp(filename, O_CLOEXEC);
+        if (fd >= 0)
+            unlink(filename);
+    } else {
+        fd = open(mem_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    }
+
+    if (fd < 0)
+        panic("%s: cannot open backing %s\n",
+              __func__, mem_path ? mem_path : "memfd");
+
+    if (fstat(fd, &info) < 0)
+        panic("%s: fstat failed\n", __func__);
+
+    if ((size_t)info.st_size < size && ftruncate(fd, (off_t)size) < 0)
+        panic("%s: cannot resize backing to 0x%lx\n", __func__, size);
+
+    return fd;
+}
+
+static void
+_ram_memfd(FILE *out, int conn, const char *args, void *opaque)
+{
+    char msg[64];
+    ram_t *ram = (ram_t *) opaque;
+
+    if (ram->fd < 0) {
+        fprintf(out, "error: ram is not shared (use --mem-path/--mem-shared)\n");
+        return;
+    }
+
+    /* Payload tells the peer where this fd lives in guest memory. */
+    snprintf(msg, sizeof(msg), "memfd 0x%lx 0x%lx\n",
+             ram->dev.as.start, ram->mem_size);
+    if (control_send_fd(conn, ram->fd, msg) < 0)
+        fprintf(out, "error: send fd failed\n");
+}
+
+int
+ram_fd(device_t *dev)
+{
+    return ((ram_t *) dev)->fd;
+}
+
+size_t
+ram_size(device_t *dev)
+{
+    return ((ram_t *) dev)->mem_size;
+}
+
+/*
+ * Replace ram with the image at @offset of @fd. Private ram just maps
+ * the image, pages are read in when the guest touches them.
+ */
+void
+ram_restore(device_t *dev, int fd, uint64_t offset)
+{
+    size_t done = 0;
+    ram_t *ram = (ram_t *) dev;
+
+    if (ram->fd < 0) {
+        void *ptr = mmap(ram->mem_ptr, ram->mem_size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_FIXED | MAP_NORESERVE,
+                         fd, (off_t)offset);
+        if (ptr == MAP_FAILED)
+            panic("%s: mmap image failed\n", __func__);
+
+        return;
+    }
+
+    while (done < ram->mem_size) {
+        ssize_t ret = pread(fd, ram->mem_ptr + done, ram->mem_size - done,
+                            (off_t)(offset + done));
+        if (ret <= 0)
+            panic("%s: read image failed\n", __func__);
+
+        done += (size_t)ret;
+    }
+}
+
+/*
+ * Start tracking written pages from now on. Every store reaches ram
+ * through ram_write(), so the bitmap is set there.
+ */
+void
+ram_track_dirty(device_t *dev)
+{
+    ram_t *ram = (ram_t *) dev;
+    size_t words = ((ram->mem_size >> PAGE_SHIFT) + 63) / 64;
+
+    if (ram->dirty == NULL)
+        ram->dirty = malloc(words * sizeof(uint64_t));
+
+    memset(ram->dirty, 0, words * sizeof(uint64_t));
+}
+
+/*
+ * Read pages written since the last reset back from the image at
+ * @offset of @fd. Returns the number of pages copied.
+ */
+size_t
+ram_reset_dirty(device_t *dev, int fd, uint64_t offset)
+{
+    size_t i;
+    size_t nr = 0;
+    ram_t *ram = (ram_t *) dev;
+    size_t pages = ram->mem_size >> PAGE_SHIFT;
+
+    if (ram->dirty == NULL)
+        panic("%s: dirty pages are not tracked\n", __func__);
+
+    for (i = 0; i < pages; ) {
+        size_t start;
+        size_t len;
+
+        if (ram->dirty[i >> 6] == 0) {
+            i = (i | 63) + 1;
+            continue;
+        }
+
+        if (!(ram->dirty[i >> 6] & (1UL << (i & 63)))) {
+            i++;
+            continue;
+        }
+
+        /* Coalesce a run of dirty pages into one read. */
+        start = i;
+        while (i < pages && (ram->dirty[i >> 6] & (1UL << (i & 63))))
+            i++;
+
+        len = (i - start) << PAGE_SHIFT;
+        if (pread(fd, ram->mem_ptr + (start << PAGE_SHIFT), len,
+                  (off_t)(offset + (start << PAGE_SHIFT))) != (ssize_t)len)
+            panic("%s: read image failed\n", __func__);
+
+        nr += i - start;
+    }
+
+    memset(ram->dirty, 0, ((pages + 63) / 64) * sizeof(uint64_t));
+    return nr;
+}
+
+static void
+ram_release(device_t *dev)
+{
+    ram_t *ram = (ram_t *) dev;
+
+    munmap(ram->mem_ptr, ram->mem_size);
+    if (ram->fd >= 0)
+        close(ram->fd);
+
+    free(ram->dirty);
+    free(ram);
+}
+
 device_t *
-ram_init(address_space *parent_as)
+ram_init(address_space *parent_as, size_t size,
+         const char *mem_path, uint32_t flags)
 {
     ram_t *ram;
 
+    if (size == 0 || (size % PAGE_SIZE) ||
+        size > RAM_SIZE_MAX)
+        panic("%s: bad size 0x%lx\n", __func__, size);
+
+    if ((flags & RAM_F_HUGETLB) && (size % HUGE_PAGE_SIZE))
+        panic("%s: size 0x%lx not align to huge page\n", __func__, size);
+
+    /* The file decides its pages, a hugetlbfs path gives huge ones */
+    if ((flags & RAM_F_HUGETLB) && mem_path)
+        panic("%s: hugepages do not apply to %s, use a hugetlbfs path\n",
+              __func__, mem_path);
+
     ram = calloc(1, sizeof(ram_t));
     ram->dev.name = "ram";
+    ram->dev.release = ram_release;
 
-    ram->mem_size = (RAM_ADDRESS_SPACE_END - RAM_ADDRESS_SPACE_START) + 1;
-    ram->mem_ptr = calloc(ram->mem_size, 1);
+    ram->mem_size = size;
+    ram->fd = -1;
+
+    if (mem_path || (flags & RAM_F_SHARED)) {
+        ram->fd = _ram_open(mem_path, size, flags);
+        ram->mem_ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_NORESERVE, ram->fd, 0);
+        if (ram->mem_ptr == MAP_FAILED)
+            panic("%s: mmap backing failed\n", __func__);
+    } else {
+        ram->mem_ptr = _ram_alloc(size, flags);
+    }
 
     init_address_space(&(ram->dev.as),
                        RAM_ADDRESS_SPACE_START,
-                       RAM_ADDRESS_SPACE_END);
+                       RAM_ADDRESS_SPACE_START + size - 1);
+
+    control_register("memfd", "pass the fd backing guest ram",
+                     _ram_memfd, ram);
 
     ram->dev.as.ops.read_op = ram_read;
     ram->dev.as.ops.write_op = ram_write;
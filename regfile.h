@@ -7,8 +7,12 @@
 
 #include <stdint.h>
 
-extern uint64_t reg[32];
-extern uint64_t freg[32];
+/* Per machine, see machine.h */
+extern __thread uint64_t reg[32];
+extern __thread uint64_t freg[32];
+
+extern __thread uint64_t _pc;
+extern __thread uint64_t _insn_count;   /* Retired instructions */
 
 const char * reg_name(uint32_t index);
 
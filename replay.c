@@ -0,0 +1,221 @@
+/*
+ * Replay
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "util.h"
+#include "list.h"
+#include "replay.h"
+
+typedef struct _replay_pending {
+    list_head   entry;
+    uint32_t    event;
+    uint64_t    data;
+} replay_pending;
+
+typedef struct _replay_handler {
+    replay_cb   cb;
+    void        *opaque;
+} replay_handler;
+
+replay_mode_t replay_mode;
+volatile uint64_t replay_icount = ~0UL;
+
+static FILE *log_fp;
+static volatile sig_atomic_t stop_sig;  /* Record: killed, end the log */
+static replay_record next;      /* Replay: record to be consumed */
+
+static replay_handler handlers[REPLAY_EVENT_LAST];
+
+static LIST_HEAD(pending);      /* Record: events from device threads */
+static pthread_mutex_t pending_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *event_names[REPLAY_EVENT_LAST] = {
+    [REPLAY_UART_INPUT] = "uart",
+    [REPLAY_TIMER]      = "timer",
+    [REPLAY_TIME]       = "time",
+    [REPLAY_CYCLE]      = "cycle",
+    [REPLAY_RTC]        = "rtc",
+};
+
+static const char *
+_event_name(uint32_t event)
+{
+    return (event < REPLAY_EVENT_LAST) ? event_names[event] : "end";
+}
+
+static bool
+_is_async(uint32_t event)
+{
+    return event < REPLAY_TIME;
+}
+
+static void
+_write(replay_event_t event, uint64_t data)
+{
+    replay_record rec = {
+        .icount = _insn_count,
+        .event = event,
+        .data = data,
+    };
+
+    if (fwrite(&rec, sizeof(rec), 1, log_fp) != 1)
+        panic("%s: write log failed\n", __func__);
+}
+
+static void
+_advance(void)
+{
+    if (fread(&next, sizeof(next), 1, log_fp) != 1) {
+        /* Out of log: the guest runs on with live inputs */
+        printf("%s: end of log at icount %lu\n", __func__, _insn_count);
+        next.event = REPLAY_EVENT_LAST;
+        replay_icount = ~0UL;
+        replay_mode = REPLAY_NONE;
+        return;
+    }
+
+    if (next.event >= REPLAY_EVENT_LAST)
+        panic("%s: bad event %u\n", __func__, next.event);
+
+    replay_icount = _is_async(next.event) ? next.icount : ~0UL;
+}
+
+static void
+_diverged(replay_event_t event)
+{
+    panic("%s: replay diverged at icount %lu: want %s, log has %s@%lu\n",
+          __func__, _insn_count, _event_name(event),
+          _event_name(next.event), next.icount);
+}
+
+void
+replay_register(replay_event_t event, replay_cb cb, void *opaque)
+{
+    handlers[event].cb = cb;
+    handlers[event].opaque = opaque;
+}
+
+void
+replay_async(replay_event_t event, uint64_t data)
+{
+    replay_pending *p = calloc(1, sizeof(replay_pending));
+    p->event = event;
+    p->data = data;
+
+    pthread_mutex_lock(&pending_mutex);
+    list_add_tail(&(p->entry), &pending);
+    replay_icount = 0;
+    pthread_mutex_unlock(&pending_mutex);
+}
+
+void
+replay_checkpoint(void)
+{
+    if (replay_mode == REPLAY_RECORD) {
+        LIST_HEAD(events);
+
+        pthread_mutex_lock(&pending_mutex);
+        list_splice_init(&pending, &events);
+        replay_icount = ~0UL;
+        pthread_mutex_unlock(&pending_mutex);
+
+        while (!list_empty(&events)) {
+            replay_pending *p;
+
+            p = list_first_entry(&events, replay_pending, entry);
+            _write(p->event, p->data);
+            handlers[p->event].cb(p->data, handlers[p->event].opaque);
+            list_del(&(p->entry));
+            free(p);
+        }
+
+        /* exit() writes the log tail, on this thread and not the handler */
+        if (stop_sig)
+            exit(128 + stop_sig);
+        return;
+    }
+
+    while (replay_mode == REPLAY_PLAY && _is_async(next.event)) {
+        if (next.icount > _insn_count)
+            return;
+        if (next.icount < _insn_count)
+            _diverged(next.event);
+
+        handlers[next.event].cb(next.data, handlers[next.event].opaque);
+        _advance();
+    }
+}
+
+uint64_t
+replay_sync(replay_event_t event, uint64_t value)
+{
+    if (replay_mode == REPLAY_RECORD) {
+        _write(event, value);
+        return value;
+    }
+
+    if (next.event != event || next.icount != _insn_count)
+        _diverged(event);
+
+    value = next.data;
+    _advance();
+    return value;
+}
+
+static void
+_replay_exit(void)
+{
+    if (replay_mode == REPLAY_RECORD)
+        printf("%s: %lu instructions recorded\n", __func__, _insn_count);
+
+    fclose(log_fp);
+}
+
+/*
+ * So that a hung guest can be killed without losing the log tail. The
+ * cpu loop ends the run in replay_checkpoint(), stdio is not safe here.
+ */
+static void
+_replay_signal(int sig)
+{
+    stop_sig = sig;
+    replay_icount = 0;
+}
+
+void
+replay_init(replay_mode_t mode, const char *filename)
+{
+    uint64_t magic = REPLAY_MAGIC;
+
+    replay_mode = mode;
+    if (mode == REPLAY_NONE)
+        return;
+
+    log_fp = fopen(filename, (mode == REPLAY_RECORD) ? "wb" : "rb");
+    if (log_fp == NULL)
+        panic("%s: cannot open %s\n", __func__, filename);
+
+    if (mode == REPLAY_RECORD) {
+        if (fwrite(&magic, sizeof(magic), 1, log_fp) != 1)
+            panic("%s: write %s failed\n", __func__, filename);
+
+        signal(SIGINT, _replay_signal);
+        signal(SIGTERM, _replay_signal);
+    } else {
+        if (fread(&magic, sizeof(magic), 1, log_fp) != 1 ||
+            magic != REPLAY_MAGIC)
+            panic("%s: bad log %s\n", __func__, filename);
+
+        _advance();
+    }
+
+    atexit(_replay_exit);
+
+    printf("%s: %s %s\n", __func__,
+           (mode == REPLAY_RECORD) ? "record to" : "replay from", filename);
+}
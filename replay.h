@@ -0,0 +1,86 @@
+/*
+ * Replay
+ */
+
+#ifndef _REPLAY_H_
+#define _REPLAY_H_
+
+#include <stdint.h>
+
+#include "types.h"
+#include "regfile.h"
+
+/*
+ * Record and replay of non-deterministic inputs. Every input is tied
+ * to the number of retired instructions when the cpu consumed it.
+ *
+ * Asynchronous events come from device threads. They are queued and
+ * applied by the cpu thread between two instructions, so the thread
+ * only decides *what* happens, never *when*. Synchronous events are
+ * values the cpu reads from the host while executing (time, cycles).
+ */
+
+#define REPLAY_MAGIC    0x59414c5045524d58UL    /* "XMREPLAY" */
+
+typedef enum _replay_mode_t {
+    REPLAY_NONE = 0,
+    REPLAY_RECORD,
+    REPLAY_PLAY,
+} replay_mode_t;
+
+typedef enum _replay_event_t {
+    /* Asynchronous */
+    REPLAY_UART_INPUT = 0,
+    REPLAY_TIMER,
+
+    /* Synchronous */
+    REPLAY_TIME,
+    REPLAY_CYCLE,
+    REPLAY_RTC,
+
+    REPLAY_EVENT_LAST,
+} replay_event_t;
+
+typedef struct _replay_record {
+    uint64_t icount;
+    uint32_t event;
+    uint32_t reserved;
+    uint64_t data;
+} replay_record;
+
+typedef void (*replay_cb)(uint64_t data, void *opaque);
+
+extern replay_mode_t replay_mode;
+
+/* Next icount to stop at in replay_checkpoint(), ~0 for none */
+extern volatile uint64_t replay_icount;
+
+void
+replay_init(replay_mode_t mode, const char *filename);
+
+/* How the cpu thread applies an asynchronous @event */
+void
+replay_register(replay_event_t event, replay_cb cb, void *opaque);
+
+/* Called by device threads when recording */
+void
+replay_async(replay_event_t event, uint64_t data);
+
+/* Called by the cpu loop when _insn_count reaches replay_icount */
+void
+replay_checkpoint(void);
+
+uint64_t
+replay_sync(replay_event_t event, uint64_t value);
+
+/* Host value @value as seen by the guest */
+static inline uint64_t
+replay_value(replay_event_t event, uint64_t value)
+{
+    if (replay_mode == REPLAY_NONE)
+        return value;
+
+    return replay_sync(event, value);
+}
+
+#endif /* _REPLAY_H_ */
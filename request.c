@@ -0,0 +1,47 @@
+/*
+ * Request
+ */
+
+#include "util.h"
+#include "request.h"
+
+#define REQUEST_MAXNUM  32
+
+typedef struct _request_item {
+    request_cb  cb;
+    void        *opaque;
+} request_item;
+
+static __thread uint32_t request_num;
+static __thread request_item request_table[REQUEST_MAXNUM];
+
+void
+request_init(void)
+{
+    request_num = 0;
+}
+
+uint32_t
+request_register(request_cb cb, void *opaque)
+{
+    if (request_num >= REQUEST_MAXNUM)
+        panic("%s: too many requests\n", __func__);
+
+    request_table[request_num].cb = cb;
+    request_table[request_num].opaque = opaque;
+
+    return 1U << request_num++;
+}
+
+void
+request_handle(void)
+{
+    uint32_t i;
+    uint32_t reqs = __atomic_exchange_n(&_machine->requests, 0,
+                                        __ATOMIC_SEQ_CST);
+
+    for (i = 0; i < request_num; i++) {
+        if (reqs & (1U << i))
+            request_table[i].cb(request_table[i].opaque);
+    }
+}
@@ -0,0 +1,44 @@
+/*
+ * Request
+ *
+ * Work that other threads (control socket, signals) want done on the
+ * cpu thread. It runs between two instructions, when the cpu state is
+ * consistent.
+ */
+
+#ifndef _REQUEST_H_
+#define _REQUEST_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "machine.h"
+
+typedef void (*request_cb)(void *opaque);
+
+/* Forget requests of a previous machine on this thread */
+void
+request_init(void);
+
+/* Returns the bit to be posted for this request */
+uint32_t
+request_register(request_cb cb, void *opaque);
+
+/* Posts to the machine the calling thread is bound to */
+static inline void
+request_post(uint32_t req)
+{
+    __atomic_or_fetch(&_machine->requests, req, __ATOMIC_SEQ_CST);
+}
+
+static inline bool
+request_pending(void)
+{
+    return _machine->requests != 0;
+}
+
+/* Called by the cpu thread when request_pending() */
+void
+request_handle(void);
+
+#endif /* _REQUEST_H_ */
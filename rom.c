@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <malloc.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include "util.h"
@@ -22,6 +23,9 @@ typedef struct _rom_t
 
     uint8_t *mem_ptr;
     size_t mem_size;
+
+    int fd;             /* Sealed contents, -1 while files are added */
+    bool mapped;        /* mem_ptr is a map_cow() of fd */
 } rom_t;
 
 
@@ -58,6 +62,26 @@ rom_read(void *dev, uint64_t addr, size_t size, params_t params)
     return 0;
 }
 
+uint8_t *
+rom_ptr(device_t *dev, size_t base, size_t size)
+{
+    return _rom_ptr(dev, base, size);
+}
+
+static void
+rom_release(device_t *dev)
+{
+    rom_t *rom = (rom_t *) dev;
+
+    if (rom->mapped)
+        munmap(rom->mem_ptr, rom->mem_size);
+    else
+        free(rom->mem_ptr);
+
+    free(rom);
+}
+
+/* Without @parent_as the rom is only a template for rom_clone() */
 device_t *
 rom_init(address_space *parent_as)
 {
@@ -65,9 +89,11 @@ rom_init(address_space *parent_as)
 
     rom = calloc(1, sizeof(rom_t));
     rom->dev.name = "rom";
+    rom->dev.release = rom_release;
 
     rom->mem_ptr = NULL;
     rom->mem_size = 0;
+    rom->fd = -1;
 
     init_address_space(&(rom->dev.as),
                        ROM_ADDRESS_SPACE_START,
@@ -77,7 +103,39 @@ rom_init(address_space *parent_as)
 
     rom->dev.as.device = rom;
 
-    register_address_space(parent_as, &(rom->dev.as));
+    if (parent_as)
+        register_address_space(parent_as, &(rom->dev.as));
+
+    return (device_t *) rom;
+}
+
+/* No more files, move the contents where rom_clone() can map them */
+void
+rom_seal(device_t *dev)
+{
+    rom_t *rom = (rom_t *) dev;
+
+    rom->fd = seal_buffer("rom", rom->mem_ptr, rom->mem_size);
+    free(rom->mem_ptr);
+
+    rom->mem_ptr = map_cow(rom->fd, rom->mem_size);
+    rom->mapped = true;
+}
+
+/* Pages are shared with @tmpl until written, e.g. by fdt fixup */
+device_t *
+rom_clone(address_space *parent_as, device_t *tmpl)
+{
+    rom_t *src = (rom_t *) tmpl;
+    rom_t *rom;
+
+    if (src->fd < 0)
+        panic("%s: rom is not sealed\n", __func__);
+
+    rom = (rom_t *) rom_init(parent_as);
+    rom->mem_size = src->mem_size;
+    rom->mem_ptr = map_cow(src->fd, src->mem_size);
+    rom->mapped = true;
 
     return (device_t *) rom;
 }
@@ -94,6 +152,9 @@ rom_add_file(device_t *dev, const char *filename, size_t base)
     if (fp == NULL || fstat(fileno(fp), &info) < 0)
         panic("%s: bad filename %s\n", __func__, filename);
 
+    if (rom->fd >= 0)
+        panic("%s: rom is sealed\n", __func__);
+
     if (base < rom->mem_size)
         panic("%s: bad base %x\n", __func__, base);
 
@@ -7,6 +7,8 @@
 
 #include "address_space.h"
 #include "device.h"
+#include "snapshot.h"
+#include "replay.h"
 
 #define RTC_ADDRESS_SPACE_START 0x0000000000101000
 #define RTC_ADDRESS_SPACE_END   0x0000000000101FFF
@@ -40,7 +42,7 @@ rtc_read(void *dev, uint64_t addr, size_t size, params_t params)
     switch (addr)
     {
     case RTC_TIME_LOW:
-        dword = (uint64_t)get_clock_realtime();
+        dword = replay_value(REPLAY_RTC, (uint64_t)get_clock_realtime());
         rtc->time_high = (uint32_t)(dword >> 32);
         return dword & 0xFFFFFFFF;
 
@@ -93,5 +95,8 @@ rtc_init(address_space *parent_as)
 
     register_address_space(parent_as, &(rtc->dev.as));
 
+    snapshot_register("rtc", &rtc->time_high,
+                      sizeof(rtc_t) - offsetof(rtc_t, time_high), NULL, NULL);
+
     return (device_t *) rtc;
 }
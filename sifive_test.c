@@ -0,0 +1,76 @@
+/*
+ * SiFive test finisher
+ *
+ * Lets the guest end the run: syscon-poweroff writes FINISHER_PASS,
+ * syscon-reboot FINISHER_RESET, and test code may write FINISHER_FAIL
+ * with an exit code in the upper half.
+ */
+
+#include <malloc.h>
+
+#include "util.h"
+#include "address_space.h"
+#include "device.h"
+#include "machine.h"
+
+#define TEST_ADDRESS_SPACE_START 0x0000000000100000
+#define TEST_ADDRESS_SPACE_END   0x0000000000100FFF
+
+#define FINISHER_FAIL   0x3333
+#define FINISHER_PASS   0x5555
+#define FINISHER_RESET  0x7777
+
+static uint64_t
+sifive_test_read(void *dev, uint64_t addr, size_t size, params_t params)
+{
+    return 0;
+}
+
+static uint64_t
+sifive_test_write(void *dev, uint64_t addr, uint64_t data, size_t size,
+                  params_t params)
+{
+    uint32_t code = (uint32_t)(data >> 16) & 0xFFFF;
+
+    if (addr != 0)
+        return 0;
+
+    switch (data & 0xFFFF)
+    {
+    case FINISHER_PASS:
+        machine_finish(_machine, MACHINE_EXIT_PASS, 0);
+        break;
+    case FINISHER_FAIL:
+        machine_finish(_machine, MACHINE_EXIT_FAIL, code);
+        break;
+    case FINISHER_RESET:
+        machine_finish(_machine, MACHINE_EXIT_RESET, 0);
+        break;
+    default:
+        printf("%s: unknown command 0x%lx\n", __func__, data);
+    }
+
+    return 0;
+}
+
+device_t *
+sifive_test_init(address_space *parent_as)
+{
+    device_t *dev;
+
+    dev = calloc(1, sizeof(device_t));
+    dev->name = "sifive_test";
+
+    init_address_space(&(dev->as),
+                       TEST_ADDRESS_SPACE_START,
+                       TEST_ADDRESS_SPACE_END);
+
+    dev->as.ops.read_op = sifive_test_read;
+    dev->as.ops.write_op = sifive_test_write;
+
+    dev->as.device = dev;
+
+    register_address_space(parent_as, &(dev->as));
+
+    return dev;
+}
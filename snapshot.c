@@ -0,0 +1,505 @@
+/*
+ * Snapshot
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "util.h"
+#include "list.h"
+#include "control.h"
+#include "request.h"
+#include "snapshot.h"
+#include "uffd.h"
+#include "coverage.h"
+
+typedef struct _snapshot_item {
+    list_head           entry;
+    const char          *name;
+    void                *ptr;
+    size_t              size;
+    const snapshot_ops  *ops;
+    void                *opaque;
+} snapshot_item;
+
+/* Per machine, the cpu thread owns it */
+static __thread list_head items;
+static __thread uint32_t nr_items;
+
+static __thread device_t *ram;
+
+static __thread pid_t saver;    /* Child that is writing ram out */
+
+static __thread uffd_t *uffd;   /* Lazy restore, until ram is filled */
+
+static __thread int base_fd = -1;   /* Snapshot that reset goes back to */
+static __thread snapshot_header base_hdr;
+static __thread snapshot_section *base_secs;
+
+/* Control socket side */
+static uint32_t save_req;
+static uint32_t reset_req;
+static char save_filename[256];   /* Under save_mutex */
+static pthread_mutex_t save_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void
+snapshot_register(const char *name, void *ptr, size_t size,
+                  const snapshot_ops *ops, void *opaque)
+{
+    snapshot_item *item;
+
+    if (strlen(name) >= SNAPSHOT_NAME_LEN)
+        panic("%s: name too long %s\n", __func__, name);
+
+    if (items.next == NULL)
+        INIT_LIST_HEAD(&items);
+
+    item = calloc(1, sizeof(snapshot_item));
+    item->name = name;
+    item->ptr = ptr;
+    item->size = size;
+    item->ops = ops;
+    item->opaque = opaque;
+    list_add_tail(&(item->entry), &items);
+    nr_items++;
+}
+
+static bool
+_page_is_zero(const uint8_t *page)
+{
+    size_t i;
+    const uint64_t *p = (const uint64_t *)page;
+
+    for (i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+        if (p[i])
+            return false;
+    }
+
+    return true;
+}
+
+static int
+_write_all(int fd, const uint8_t *buf, size_t size, uint64_t offset)
+{
+    while (size) {
+        ssize_t ret = pwrite(fd, buf, size, (off_t)offset);
+        if (ret <= 0)
+            return -1;
+
+        buf += ret;
+        size -= (size_t)ret;
+        offset += (uint64_t)ret;
+    }
+
+    return 0;
+}
+
+/* Write state and the non-zero runs of ram, leave holes for the rest. */
+static int
+_write_image(int fd, const uint8_t *state, size_t state_size,
+             uint64_t ram_offset)
+{
+    size_t i;
+    size_t run = 0;
+    size_t size = ram_size(ram);
+    const uint8_t *base = ram_ptr(ram, RAM_ADDRESS_SPACE_START, size);
+
+    if (_write_all(fd, state, state_size, 0) < 0)
+        return -1;
+
+    for (i = 0; i <= size; i += PAGE_SIZE) {
+        if (i < size && !_page_is_zero(base + i)) {
+            run += PAGE_SIZE;
+            continue;
+        }
+
+        if (run) {
+            if (_write_all(fd, base + i - run, run,
+                           ram_offset + i - run) < 0)
+                return -1;
+            run = 0;
+        }
+    }
+
+    return ftruncate(fd, (off_t)(ram_offset + size));
+}
+
+#define PAGEMAP_PRESENT     (1UL << 63)
+#define PAGEMAP_SWAPPED     (1UL << 62)
+
+/*
+ * Pages mapped into this process are the ones the guest touched, give
+ * or take read fault-around. Not mincore(): after a restore that maps
+ * the image, it reports the page cache of the file, not the guest.
+ */
+static uint32_t *
+_capture_hot(size_t *pnr)
+{
+    int fd;
+    size_t i;
+    size_t nr = 0;
+    size_t size = ram_size(ram);
+    size_t pages = size >> PAGE_SHIFT;
+    uint64_t *entries = malloc(pages * sizeof(*entries));
+    uintptr_t base = (uintptr_t)ram_ptr(ram, RAM_ADDRESS_SPACE_START, size);
+    uint32_t *hot = NULL;
+
+    *pnr = 0;
+
+    fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        free(entries);
+        return NULL;
+    }
+
+    if (pread(fd, entries, pages * sizeof(*entries),
+              (off_t)((base >> PAGE_SHIFT) * sizeof(*entries))) !=
+        (ssize_t)(pages * sizeof(*entries))) {
+        close(fd);
+        free(entries);
+        return NULL;
+    }
+    close(fd);
+
+    for (i = 0; i < pages; i++) {
+        if (entries[i] & (PAGEMAP_PRESENT | PAGEMAP_SWAPPED))
+            nr++;
+    }
+
+    if (nr)
+        hot = malloc(nr * sizeof(*hot));
+    for (i = 0, nr = 0; hot && i < pages; i++) {
+        if (entries[i] & (PAGEMAP_PRESENT | PAGEMAP_SWAPPED))
+            hot[nr++] = (uint32_t)i;
+    }
+
+    free(entries);
+    *pnr = nr;
+    return hot;
+}
+
+static uint8_t *
+_capture_state(size_t *psize, uint64_t *pram_offset)
+{
+    uint8_t *buf;
+    size_t offset;
+    size_t nr_hot;
+    uint32_t *hot;
+    snapshot_item *item;
+    snapshot_header *hdr;
+    snapshot_section *sec;
+
+    hot = _capture_hot(&nr_hot);
+
+    offset = sizeof(snapshot_header) + nr_items * sizeof(snapshot_section);
+    list_for_each_entry(item, &items, entry)
+        offset += item->size;
+
+    offset += nr_hot * sizeof(uint32_t);
+
+    *pram_offset = ROUND_UP(offset, PAGE_SIZE);
+    *psize = offset;
+
+    buf = calloc(1, offset);
+    hdr = (snapshot_header *)buf;
+    hdr->magic = SNAPSHOT_MAGIC;
+    hdr->version = SNAPSHOT_VERSION;
+    hdr->nr_sections = nr_items;
+    hdr->ram_base = RAM_ADDRESS_SPACE_START;
+    hdr->ram_size = ram_size(ram);
+    hdr->ram_offset = *pram_offset;
+
+    sec = (snapshot_section *)(hdr + 1);
+    offset = sizeof(snapshot_header) + nr_items * sizeof(snapshot_section);
+
+    list_for_each_entry(item, &items, entry) {
+        if (item->ops && item->ops->pre_save)
+            item->ops->pre_save(item->opaque);
+
+        strcpy(sec->name, item->name);
+        sec->offset = offset;
+        sec->size = item->size;
+        memcpy(buf + offset, item->ptr, item->size);
+
+        offset += item->size;
+        sec++;
+    }
+
+    hdr->hot_offset = offset;
+    hdr->nr_hot = nr_hot;
+    if (nr_hot)
+        memcpy(buf + offset, hot, nr_hot * sizeof(uint32_t));
+    free(hot);
+
+    return buf;
+}
+
+/*
+ * Must be called between instructions. With private ram, the image is
+ * written by a forked child from its copy-on-write view of ram, so the
+ * guest goes on at once. Shared ram is written in place.
+ */
+int
+snapshot_save(const char *filename)
+{
+    int fd;
+    int ret = 0;
+    pid_t pid = -1;
+    uint8_t *state;
+    size_t state_size;
+    uint64_t ram_offset;
+    char tmpname[sizeof(save_filename) + 8];
+
+    if (saver > 0) {
+        waitpid(saver, NULL, 0);
+        saver = 0;
+    }
+
+    state = _capture_state(&state_size, &ram_offset);
+
+    /* Never truncate a file that ram may be mapped from. */
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename);
+    fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        printf("%s: cannot create %s\n", __func__, tmpname);
+        free(state);
+        return -1;
+    }
+
+    /* A forked child would see pages not yet filled as zero. */
+    if (ram_fd(ram) < 0 && !uffd_active(uffd))
+        pid = fork();
+
+    if (pid <= 0) {
+        if (_write_image(fd, state, state_size, ram_offset) < 0 ||
+            rename(tmpname, filename) < 0)
+            ret = -1;
+
+        if (pid == 0)
+            _exit(ret ? 1 : 0);
+
+        printf("%s: %s %s\n", __func__, filename, ret ? "failed" : "saved");
+    } else {
+        saver = pid;
+    }
+
+    close(fd);
+    free(state);
+    return ret;
+}
+
+static void
+_load_sections(int fd, snapshot_header *hdr, snapshot_section *secs)
+{
+    uint32_t i;
+    snapshot_item *item;
+
+    list_for_each_entry(item, &items, entry) {
+        for (i = 0; i < hdr->nr_sections; i++) {
+            if (streq(secs[i].name, item->name))
+                break;
+        }
+
+        if (i == hdr->nr_sections || secs[i].size != item->size)
+            panic("%s: section %s mismatch\n", __func__, item->name);
+
+        if (pread(fd, item->ptr, item->size, (off_t)secs[i].offset) !=
+            (ssize_t)item->size)
+            panic("%s: read section %s failed\n", __func__, item->name);
+    }
+}
+
+static void
+_post_load(void)
+{
+    snapshot_item *item;
+
+    list_for_each_entry(item, &items, entry) {
+        if (item->ops && item->ops->post_load)
+            item->ops->post_load(item->opaque);
+    }
+}
+
+void
+snapshot_load(const char *filename, bool lazy)
+{
+    int fd;
+    snapshot_header hdr;
+    snapshot_section *secs;
+    size_t table_size;
+
+    /* Ram cannot be registered twice, nor refilled under the threads */
+    if (uffd) {
+        uffd_stop(uffd);
+        uffd = NULL;
+    }
+
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        panic("%s: cannot open %s\n", __func__, filename);
+
+    if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+        hdr.magic != SNAPSHOT_MAGIC || hdr.version != SNAPSHOT_VERSION)
+        panic("%s: bad snapshot %s\n", __func__, filename);
+
+    if (hdr.ram_base != RAM_ADDRESS_SPACE_START ||
+        hdr.ram_size != ram_size(ram))
+        panic("%s: ram size 0x%lx, but snapshot has 0x%lx\n",
+              __func__, ram_size(ram), hdr.ram_size);
+
+    table_size = hdr.nr_sections * sizeof(snapshot_section);
+    secs = malloc(table_size);
+    if (pread(fd, secs, table_size, sizeof(hdr)) != (ssize_t)table_size)
+        panic("%s: bad section table\n", __func__);
+
+    _load_sections(fd, &hdr, secs);
+
+    if (lazy) {
+        uint32_t *hot = NULL;
+        size_t hot_size = hdr.nr_hot * sizeof(*hot);
+
+        if (hot_size)
+            hot = malloc(hot_size);
+
+        if (ram_fd(ram) >= 0)
+            panic("%s: lazy restore needs private ram\n", __func__);
+
+        if (pread(fd, hot, hot_size, (off_t)hdr.hot_offset) !=
+            (ssize_t)hot_size)
+            panic("%s: bad hot pages\n", __func__);
+
+        uffd = uffd_restore(ram_ptr(ram, RAM_ADDRESS_SPACE_START,
+                                    ram_size(ram)),
+                            ram_size(ram), fd, hdr.ram_offset,
+                            hot, hdr.nr_hot);
+    } else {
+        ram_restore(ram, fd, hdr.ram_offset);
+    }
+
+    _post_load();
+
+    /* Keep the file open, snapshot_reset() goes back to it. */
+    if (base_fd >= 0) {
+        close(base_fd);
+        free(base_secs);
+    }
+    base_fd = fd;
+    base_hdr = hdr;
+    base_secs = secs;
+    ram_track_dirty(ram);
+
+    printf("%s: %s restored\n", __func__, filename);
+}
+
+size_t
+snapshot_reset(void)
+{
+    size_t nr;
+
+    if (base_fd < 0)
+        panic("%s: no snapshot loaded\n", __func__);
+
+    _load_sections(base_fd, &base_hdr, base_secs);
+    nr = ram_reset_dirty(ram, base_fd, base_hdr.ram_offset);
+    _post_load();
+    coverage_reset();
+
+    return nr;
+}
+
+static void
+_save_request(void *opaque)
+{
+    char filename[sizeof(save_filename)];
+
+    /* The control thread may be writing the next name */
+    pthread_mutex_lock(&save_mutex);
+    strcpy(filename, save_filename);
+    pthread_mutex_unlock(&save_mutex);
+
+    snapshot_save(filename);
+}
+
+static void
+_reset_request(void *opaque)
+{
+    if (base_fd < 0) {
+        printf("%s: no snapshot loaded (use --restore)\n", __func__);
+        return;
+    }
+
+    snapshot_reset();
+}
+
+static void
+_control_reset(FILE *out, int conn, const char *args, void *opaque)
+{
+    request_post(reset_req);
+    fprintf(out, "ok\n");
+}
+
+static void
+_control_save(FILE *out, int conn, const char *args, void *opaque)
+{
+    if (*args == '\0' || strlen(args) >= sizeof(save_filename)) {
+        fprintf(out, "error: usage: save FILE\n");
+        return;
+    }
+
+    pthread_mutex_lock(&save_mutex);
+    strcpy(save_filename, args);
+    pthread_mutex_unlock(&save_mutex);
+
+    request_post(save_req);
+    fprintf(out, "ok\n");
+}
+
+void
+snapshot_init(device_t *ram_dev)
+{
+    ram = ram_dev;
+
+    save_req = request_register(_save_request, NULL);
+    control_register("save", "save a snapshot to FILE", _control_save, NULL);
+
+    reset_req = request_register(_reset_request, NULL);
+    control_register("reset", "go back to the restored snapshot",
+                     _control_reset, NULL);
+}
+
+void
+snapshot_exit(void)
+{
+    /* Before ram and base_fd go, the threads work on both */
+    if (uffd) {
+        uffd_stop(uffd);
+        uffd = NULL;
+    }
+
+    if (saver > 0) {
+        waitpid(saver, NULL, 0);
+        saver = 0;
+    }
+
+    if (base_fd >= 0) {
+        close(base_fd);
+        free(base_secs);
+        base_fd = -1;
+        base_secs = NULL;
+    }
+
+    while (items.next && !list_empty(&items)) {
+        snapshot_item *item = list_first_entry(&items, snapshot_item, entry);
+        list_del(&(item->entry));
+        free(item);
+    }
+
+    nr_items = 0;
+    ram = NULL;
+}
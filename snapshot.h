@@ -0,0 +1,81 @@
+/*
+ * Snapshot
+ */
+
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "device.h"
+
+#define SNAPSHOT_MAGIC      0x50414e53554d4558UL    /* 'XEMUSNAP' */
+#define SNAPSHOT_VERSION    2
+
+#define SNAPSHOT_NAME_LEN   32
+
+/*
+ * File layout:
+ *   header | section table | section data | hot pages | pad | ram
+ * Ram is stored as an image of the whole guest ram at a page aligned
+ * offset, with zero pages left as holes. So it can be mapped as it is.
+ * Hot pages are the indexes (uint32_t) of ram pages that were resident
+ * when the snapshot was taken; lazy restore fetches them first.
+ */
+typedef struct _snapshot_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t nr_sections;
+    uint64_t ram_base;
+    uint64_t ram_size;
+    uint64_t ram_offset;
+    uint64_t hot_offset;
+    uint64_t nr_hot;
+} snapshot_header;
+
+typedef struct _snapshot_section {
+    char     name[SNAPSHOT_NAME_LEN];
+    uint64_t offset;
+    uint64_t size;
+} snapshot_section;
+
+typedef struct _snapshot_ops {
+    void (*pre_save)(void *opaque);
+    void (*post_load)(void *opaque);
+} snapshot_ops;
+
+/*
+ * Save [ptr, ptr + size) as section @name. @ops can be NULL.
+ * Only plain data can be registered, not locks or host pointers.
+ */
+void
+snapshot_register(const char *name, void *ptr, size_t size,
+                  const snapshot_ops *ops, void *opaque);
+
+void
+snapshot_init(device_t *ram);
+
+/* Drop everything registered by the machine on this thread */
+void
+snapshot_exit(void);
+
+int
+snapshot_save(const char *filename);
+
+/*
+ * With @lazy, ram pages are filled from the file on first touch and by
+ * a background prefetcher, so the guest starts before ram is read.
+ */
+void
+snapshot_load(const char *filename, bool lazy);
+
+/*
+ * Incremental reset to the snapshot that was loaded: device state is
+ * read again and only ram pages written since are copied back.
+ * Returns the number of pages copied.
+ */
+size_t
+snapshot_reset(void);
+
+#endif /* _SNAPSHOT_H_ */
@@ -0,0 +1,289 @@
+/*
+ * Stats
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+#include "stats.h"
+#include "util.h"
+#include "csr.h"
+#include "device.h"
+#include "machine.h"
+#include "request.h"
+#include "annotate.h"
+
+typedef enum {
+    CLASS_ALU = 0,
+    CLASS_MULDIV,
+    CLASS_BRANCH,
+    CLASS_LOAD,
+    CLASS_STORE,
+    CLASS_AMO,
+    CLASS_CSR,
+    CLASS_SYSTEM,
+    CLASS_FP,
+    CLASS_MAX,
+} op_class;
+
+static const char *class_names[CLASS_MAX] = {
+    [CLASS_ALU]     = "alu",
+    [CLASS_MULDIV]  = "muldiv",
+    [CLASS_BRANCH]  = "branch",
+    [CLASS_LOAD]    = "load",
+    [CLASS_STORE]   = "store",
+    [CLASS_AMO]     = "amo",
+    [CLASS_CSR]     = "csr",
+    [CLASS_SYSTEM]  = "system",
+    [CLASS_FP]      = "fp",
+};
+
+static const char *priv_names[4] = { "U", "S", "H", "M" };
+
+typedef struct _stats_t {
+    const char  *filename;
+    uint32_t    dump_req;
+
+    uint64_t    ops[OP_MAX_NUM];
+    uint64_t    class_count[CLASS_MAX];
+    uint64_t    class_ticks[CLASS_MAX];
+
+    uint64_t    mem_reads;      /* Ram, rom and flash */
+    uint64_t    mem_writes;
+    uint64_t    mmio_reads;
+    uint64_t    mmio_writes;
+
+    /* [interrupt][cause][from priv] */
+    uint64_t    traps[2][16][4];
+} stats_t;
+
+__thread bool stats_on;
+__thread uint64_t as_last_paddr;
+
+static __thread stats_t *stats;
+
+/* SIGUSR1 dumps the stats of the first machine that has them on */
+static machine_t *signal_machine;
+static uint32_t signal_req;
+
+static op_class
+_class(op_t op)
+{
+    if (op >= JAL && op <= BGEU)
+        return CLASS_BRANCH;
+    if ((op >= LB && op <= LWU) || op == FLW || op == FLD)
+        return CLASS_LOAD;
+    if ((op >= SB && op <= SD) || op == FSW || op == FSD)
+        return CLASS_STORE;
+    if (op >= AMO_ADD_D && op <= AMO_MAXU_W)
+        return CLASS_AMO;
+    if (op >= MUL && op <= REMUW)
+        return CLASS_MULDIV;
+    if (op >= CSRRW && op <= CSRRCI)
+        return CLASS_CSR;
+    if (op >= FENCE && op <= SFENCE_VMA)
+        return CLASS_SYSTEM;
+    if (op == FMV_W_X)
+        return CLASS_FP;
+
+    return CLASS_ALU;
+}
+
+void
+stats_retire(op_t op, uint64_t ticks)
+{
+    op_class class;
+    bool is_mem;
+
+    if (op >= OP_MAX_NUM)
+        return;
+
+    class = _class(op);
+    stats->ops[op]++;
+    stats->class_count[class]++;
+    stats->class_ticks[class] += ticks;
+
+    if (class != CLASS_LOAD && class != CLASS_STORE && class != CLASS_AMO)
+        return;
+
+    /* Cleared before execute, still clear if the access faulted */
+    if (as_last_paddr == ~0UL)
+        return;
+
+    /* As the metrics count mmio: rom and flash are memory */
+    is_mem = !is_mmio(as_last_paddr);
+    if (class == CLASS_LOAD) {
+        if (is_mem)
+            stats->mem_reads++;
+        else
+            stats->mmio_reads++;
+    } else {
+        if (is_mem)
+            stats->mem_writes++;
+        else
+            stats->mmio_writes++;
+    }
+}
+
+void
+stats_trap(uint64_t cause, uint32_t from_priv)
+{
+    uint32_t intr = (cause & BIT_CAUSE_INTR) ? 1 : 0;
+
+    if (!stats_on)
+        return;
+
+    stats->traps[intr][cause & 0xF][from_priv & 3]++;
+}
+
+void
+stats_reset(void)
+{
+    const char *filename = stats->filename;
+    uint32_t dump_req = stats->dump_req;
+
+    memset(stats, 0, sizeof(stats_t));
+    stats->filename = filename;
+    stats->dump_req = dump_req;
+}
+
+static int
+_compare_ops(const void *a, const void *b)
+{
+    uint64_t x = stats->ops[*(const op_t *)a];
+    uint64_t y = stats->ops[*(const op_t *)b];
+
+    return (x < y) - (x > y);
+}
+
+void
+stats_dump(void)
+{
+    uint32_t i;
+    uint32_t j;
+    uint32_t k;
+    uint64_t total = 0;
+    op_t order[OP_MAX_NUM];
+    FILE *fp = report_open(stats->filename);
+
+    if (fp == NULL)
+        return;
+
+    for (i = 0; i < OP_MAX_NUM; i++) {
+        order[i] = (op_t) i;
+        total += stats->ops[i];
+    }
+    qsort(order, OP_MAX_NUM, sizeof(op_t), _compare_ops);
+
+    fprintf(fp, "== stats: %lu insns\n", total);
+
+    fprintf(fp, "\n%-12s %14s %7s\n", "op", "count", "%");
+    for (i = 0; i < OP_MAX_NUM && stats->ops[order[i]]; i++) {
+        uint64_t n = stats->ops[order[i]];
+        fprintf(fp, "%-12s %14lu %6.2f%%\n",
+                op_name(order[i]), n, 100.0 * (double)n / (double)total);
+    }
+
+    fprintf(fp, "\n%-12s %14s %16s %10s\n",
+            "class", "count", "host ticks", "ticks/op");
+    for (i = 0; i < CLASS_MAX; i++) {
+        uint64_t n = stats->class_count[i];
+        if (n == 0)
+            continue;
+
+        fprintf(fp, "%-12s %14lu %16lu %10.1f\n", class_names[i], n,
+                stats->class_ticks[i],
+                (double)stats->class_ticks[i] / (double)n);
+    }
+
+    fprintf(fp, "\n%-12s %14s %14s\n", "access", "reads", "writes");
+    fprintf(fp, "%-12s %14lu %14lu\n", "memory",
+            stats->mem_reads, stats->mem_writes);
+    fprintf(fp, "%-12s %14lu %14lu\n", "mmio",
+            stats->mmio_reads, stats->mmio_writes);
+
+    fprintf(fp, "\n%-12s %6s %4s %14s\n", "trap", "cause", "from", "count");
+    for (i = 0; i < 2; i++) {
+        for (j = 0; j < 16; j++) {
+            for (k = 0; k < 4; k++) {
+                if (stats->traps[i][j][k] == 0)
+                    continue;
+
+                fprintf(fp, "%-12s %6u %4s %14lu\n",
+                        i ? "interrupt" : "exception", j, priv_names[k],
+                        stats->traps[i][j][k]);
+            }
+        }
+    }
+
+    fprintf(fp, "\n");
+
+    report_close(fp);
+}
+
+static void
+_dump_request(void *opaque)
+{
+    if (stats)
+        stats_dump();
+}
+
+static void
+_signal(int sig)
+{
+    machine_t *m = signal_machine;
+
+    if (m)
+        __atomic_or_fetch(&m->requests, signal_req, __ATOMIC_SEQ_CST);
+}
+
+static void
+_annotate(annotate_cmd cmd, uint64_t arg, void *opaque)
+{
+    if (cmd == ANNOTATE_RESET_STATS)
+        stats_reset();
+    else if (cmd == ANNOTATE_DUMP_STATS)
+        stats_dump();
+}
+
+void
+stats_init(const char *filename)
+{
+    stats_on = false;
+    stats = NULL;
+
+    if (filename == NULL)
+        return;
+
+    stats = calloc(1, sizeof(stats_t));
+    stats->filename = filename;
+    stats->dump_req = request_register(_dump_request, NULL);
+    stats_on = true;
+
+    annotate_register(_annotate, NULL);
+
+    if (__sync_bool_compare_and_swap(&signal_machine, NULL, _machine)) {
+        signal_req = stats->dump_req;
+        signal(SIGUSR1, _signal);
+    }
+}
+
+void
+stats_exit(void)
+{
+    if (stats == NULL)
+        return;
+
+    if (signal_machine == _machine) {
+        signal(SIGUSR1, SIG_IGN);
+        signal_machine = NULL;
+    }
+
+    stats_dump();
+
+    free(stats);
+    stats = NULL;
+    stats_on = false;
+}
@@ -0,0 +1,43 @@
+/*
+ * Stats
+ *
+ * Dynamic instruction mix: retirements per op, host cycles per class
+ * of op (rdtsc around decode and execute), ram versus mmio accesses
+ * and traps by cause and privilege. Off unless stats_init() is given
+ * a file; the run loop then pays one test per instruction.
+ */
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "operation.h"
+
+extern __thread bool stats_on;
+
+/* Physical address of the last data access, see as_read() */
+extern __thread uint64_t as_last_paddr;
+
+/* Dump to @filename ("-" for stderr) on exit, SIGUSR1 or request */
+void
+stats_init(const char *filename);
+
+void
+stats_exit(void);
+
+void
+stats_reset(void);
+
+void
+stats_dump(void);
+
+/* An instruction retired, @ticks are host ticks since decode began */
+void
+stats_retire(op_t op, uint64_t ticks);
+
+void
+stats_trap(uint64_t cause, uint32_t from_priv);
+
+#endif /* _STATS_H_ */
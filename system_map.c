@@ -20,16 +20,25 @@ static system_map_item *table;
 static size_t last;
 static size_t size;
 
-void
-setup_system_map(void)
+static int
+_compare(const void *a, const void *b)
+{
+    const system_map_item *x = a;
+    const system_map_item *y = b;
+
+    return (x->addr > y->addr) - (x->addr < y->addr);
+}
+
+static void
+_load(const char *filename)
 {
     FILE *fp;
     char line[256];
 
-    fp = fopen(SYSTEM_MAP_FILE, "r");
+    fp = fopen(filename, "r");
     if (fp == NULL) {
         panic("%s: bad system map file %s\n",
-              __func__, SYSTEM_MAP_FILE);
+              __func__, filename);
         return;
     }
 
@@ -67,6 +76,42 @@ setup_system_map(void)
     }
 
     fclose(fp);
+
+    /* Sorted by address for lookup_system_map() */
+    qsort(table, last, sizeof(system_map_item), _compare);
+}
+
+void
+setup_system_map(void)
+{
+    _load(SYSTEM_MAP_FILE);
+}
+
+void
+add_system_map(const char *filename)
+{
+    _load(filename);
+}
+
+const char *
+lookup_system_map(uint64_t addr, uint64_t *start)
+{
+    size_t lo = 0;
+    size_t hi = last;
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (table[mid].addr <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == 0)
+        return NULL;
+
+    *start = table[lo - 1].addr;
+    return table[lo - 1].name;
 }
 
 const char *
@@ -13,4 +13,15 @@ setup_system_map(void);
 const char *
 match_in_system_map(const char *name, uint64_t *paddr);
 
+/* Add symbols from another map in the same format, e.g. for modules */
+void
+add_system_map(const char *filename);
+
+/*
+ * Symbol that covers @addr, i.e. the closest one below it. Returns
+ * NULL if there is none and sets *@start to where it begins.
+ */
+const char *
+lookup_system_map(uint64_t addr, uint64_t *start);
+
 #endif /* _SYSTEM_MAP_H_ */
@@ -0,0 +1,721 @@
+/*
+ * Microbenchmarks
+ *
+ * Times the hot paths of the emulator on their own: decode, execute by
+ * op class, physical access dispatch, page walks, csr access and
+ * virtqueue pops. Each benchmark runs a fixed number of ops per round
+ * for a number of rounds, after one warm up round, and prints ns/op as
+ * min, median, mean and standard deviation, tab separated.
+ *
+ * With -c, medians are compared to an earlier run and the exit status
+ * is 1 if any got slower by more than the threshold.
+ *
+ * Run it from the top of the tree: the machine it creates loads its
+ * images from ./image, as xemu does.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+
+#include "util.h"
+#include "machine.h"
+#include "decode.h"
+#include "execute.h"
+#include "regfile.h"
+#include "csr.h"
+#include "mmu.h"
+#include "virtio.h"
+
+#define DEFAULT_ROUNDS  10
+#define DEFAULT_THRESH  20.0    /* Percent */
+#define BENCH_MAX       64
+
+/* Device registers, from the virt board. The rtc is last in the list */
+#define UART_LSR        0x10000005UL
+#define RTC_ALARM_STATUS 0x00101018UL
+#define PLIC_S_ENABLE   0x0c002080UL
+#define VIRTIO_MAGIC    0x10001000UL
+
+/* Guest ram used by the benchmarks */
+#define DATA            (RAM_ADDRESS_SPACE_START + 0x1000)
+#define PT_ROOT         (RAM_ADDRESS_SPACE_START + 0x10000)
+#define PT_L1_4K        (RAM_ADDRESS_SPACE_START + 0x11000)
+#define PT_L0_4K        (RAM_ADDRESS_SPACE_START + 0x12000)
+#define PT_L1_2M        (RAM_ADDRESS_SPACE_START + 0x13000)
+#define VQ_RING         (RAM_ADDRESS_SPACE_START + 0x20000)
+#define VQ_TABLE        (RAM_ADDRESS_SPACE_START + 0x22000)
+#define PAGES           (RAM_ADDRESS_SPACE_START + 0x100000)
+
+/* Virtual ranges for the walks, one per leaf level */
+#define VA_4K           0x40000000UL
+#define VA_2M           0xc0000000UL
+#define VA_1G           0x100000000UL
+
+#define PTE_V           0x01
+#define PTE_RWX         0x0e
+#define PTE_AD          0xc0
+#define SATP_SV39       (8UL << 60)
+
+#define VQ_NUM          8
+
+typedef struct _insn_t {
+    uint32_t    inst;
+    const char  *cls;           /* Op class for execute */
+    const char  *text;
+} insn_t;
+
+/* Operands: t0 = rd, t1 = a pointer into DATA, t2 = 3 */
+static const insn_t insns32[] = {
+    {0x007302b3, "alu",     "add t0, t1, t2"},
+    {0x00130293, "alu",     "addi t0, t1, 1"},
+    {0x00331293, "alu",     "slli t0, t1, 3"},
+    {0x007342b3, "alu",     "xor t0, t1, t2"},
+    {0x007332b3, "alu",     "sltu t0, t1, t2"},
+    {0x007302bb, "alu",     "addw t0, t1, t2"},
+    {0x123452b7, "alu",     "lui t0, 0x12345"},
+    {0x00000297, "alu",     "auipc t0, 0"},
+    {0x027302b3, "muldiv",  "mul t0, t1, t2"},
+    {0x027332b3, "muldiv",  "mulhu t0, t1, t2"},
+    {0x027342b3, "muldiv",  "div t0, t1, t2"},
+    {0x027372b3, "muldiv",  "remu t0, t1, t2"},
+    {0x00730463, "branch",  "beq t1, t2, 8"},
+    {0x00731463, "branch",  "bne t1, t2, 8"},
+    {0x00734463, "branch",  "blt t1, t2, 8"},
+    {0x00737463, "branch",  "bgeu t1, t2, 8"},
+    {0x010000ef, "branch",  "jal ra, 16"},
+    {0x000300e7, "branch",  "jalr ra, 0(t1)"},
+    {0x00033283, "load",    "ld t0, 0(t1)"},
+    {0x00432283, "load",    "lw t0, 4(t1)"},
+    {0x00635283, "load",    "lhu t0, 6(t1)"},
+    {0x00134283, "load",    "lbu t0, 1(t1)"},
+    {0x00733423, "store",   "sd t2, 8(t1)"},
+    {0x00732823, "store",   "sw t2, 16(t1)"},
+    {0x00731a23, "store",   "sh t2, 20(t1)"},
+    {0x00730123, "store",   "sb t2, 2(t1)"},
+    {0x100332af, "amo",     "lr.d t0, (t1)"},
+    {0x187332af, "amo",     "sc.d t0, t2, (t1)"},
+    {0x007332af, "amo",     "amoadd.d t0, t2, (t1)"},
+    {0x087322af, "amo",     "amoswap.w t0, t2, (t1)"},
+    {0x340022f3, "csr",     "csrr t0, mscratch"},
+    {0x34039073, "csr",     "csrw mscratch, t2"},
+    {0x304022f3, "csr",     "csrr t0, mie"},
+    {0x300022f3, "csr",     "csrr t0, mstatus"},
+    {0x00033007, "fp",      "fld ft0, 0(t1)"},
+    {0x00033427, "fp",      "fsd ft0, 8(t1)"},
+};
+
+static const insn_t insns16[] = {
+    {0x0405, "alu",     "c.addi s0, 1"},
+    {0x4515, "alu",     "c.li a0, 5"},
+    {0x852e, "alu",     "c.mv a0, a1"},
+    {0x952e, "alu",     "c.add a0, a1"},
+    {0x8d0d, "alu",     "c.sub a0, a1"},
+    {0x050e, "alu",     "c.slli a0, 3"},
+    {0x2505, "alu",     "c.addiw a0, 1"},
+    {0x6505, "alu",     "c.lui a0, 1"},
+    {0x713d, "alu",     "c.addi16sp sp, -32"},
+    {0x0808, "alu",     "c.addi4spn a0, sp, 16"},
+    {0x6188, "load",    "c.ld a0, 0(a1)"},
+    {0x41c8, "load",    "c.lw a0, 4(a1)"},
+    {0x60a2, "load",    "c.ldsp ra, 8(sp)"},
+    {0xe588, "store",   "c.sd a0, 8(a1)"},
+    {0xc5c8, "store",   "c.sw a0, 12(a1)"},
+    {0xe406, "store",   "c.sdsp ra, 8(sp)"},
+    {0xa801, "branch",  "c.j 16"},
+    {0xc501, "branch",  "c.beqz a0, 8"},
+    {0xe501, "branch",  "c.bnez a0, 8"},
+    {0x8082, "branch",  "c.jr ra"},
+    {0x9582, "branch",  "c.jalr a1"},
+};
+
+#define NR_INSNS32  (sizeof(insns32) / sizeof(insns32[0]))
+#define NR_INSNS16  (sizeof(insns16) / sizeof(insns16[0]))
+
+typedef struct _decoded_t {
+    uint64_t    next_pc;
+    op_t        op;
+    uint32_t    rd;
+    uint32_t    rs1;
+    uint32_t    rs2;
+    uint64_t    imm;
+    uint32_t    csr_addr;
+} decoded_t;
+
+typedef struct _op_class_t {
+    const char  *name;
+    uint32_t    num;
+    decoded_t   ops[NR_INSNS32];
+} op_class_t;
+
+static op_class_t op_classes[] = {
+    {"alu"}, {"muldiv"}, {"branch"}, {"load"}, {"store"}, {"amo"},
+    {"csr"}, {"fp"},
+};
+
+#define NR_CLASSES  (sizeof(op_classes) / sizeof(op_classes[0]))
+
+typedef struct _access_t {
+    uint64_t    addr;
+    size_t      size;
+} access_t;
+
+static const access_t access_ram = {DATA, 8};
+static const access_t access_uart = {UART_LSR, 1};
+static const access_t access_rtc = {RTC_ALARM_STATUS, 4};
+static const access_t access_plic = {PLIC_S_ENABLE, 4};
+static const access_t access_virtio = {VIRTIO_MAGIC, 4};
+
+static const uint64_t walk_4k = VA_4K;
+static const uint64_t walk_2m = VA_2M;
+static const uint64_t walk_1g = VA_1G;
+
+typedef struct _bench_t {
+    const char  *name;
+    uint64_t    ops;            /* Per round */
+    void        (*run)(const void *arg, uint64_t n);
+    const void  *arg;
+
+    double      *ns;            /* Per op, one per round */
+    double      min;
+    double      median;
+    double      mean;
+    double      stddev;
+} bench_t;
+
+static machine_t *m;
+static volatile uint64_t sink;
+
+static vqueue_t vq;
+static virtio_dev_t vdev;
+
+static bench_t benches[BENCH_MAX];
+static uint32_t nr_benches;
+
+/*
+ * Benchmarks
+ */
+
+static void
+run_dec32(const void *arg, uint64_t n)
+{
+    uint64_t i;
+    uint64_t sum = 0;
+
+    for (i = 0; i < n; i++) {
+        op_t op;
+        uint32_t rd, rs1, rs2, csr_addr, opcode;
+        uint64_t imm;
+
+        dec32(RAM_ADDRESS_SPACE_START, insns32[i % NR_INSNS32].inst,
+              &op, &rd, &rs1, &rs2, &imm, &csr_addr, &opcode);
+        sum += op + imm;
+    }
+
+    sink = sum;
+}
+
+static void
+run_dec16(const void *arg, uint64_t n)
+{
+    uint64_t i;
+    uint64_t sum = 0;
+
+    for (i = 0; i < n; i++) {
+        op_t op;
+        uint32_t rd, rs1, rs2, csr_addr, opcode;
+        uint64_t imm;
+
+        dec16(RAM_ADDRESS_SPACE_START,
+              (uint16_t)insns16[i % NR_INSNS16].inst,
+              &op, &rd, &rs1, &rs2, &imm, &csr_addr, &opcode);
+        sum += op + imm;
+    }
+
+    sink = sum;
+}
+
+static void
+run_execute(const void *arg, uint64_t n)
+{
+    const op_class_t *cls = arg;
+    uint64_t i;
+    uint64_t sum = 0;
+
+    for (i = 0; i < n; i++) {
+        const decoded_t *d = &cls->ops[i % cls->num];
+
+        sum += execute(&m->root_as, RAM_ADDRESS_SPACE_START, d->next_pc,
+                       d->op, d->rd, d->rs1, d->rs2, d->imm, d->csr_addr);
+    }
+
+    sink = sum;
+}
+
+static void
+run_as_read(const void *arg, uint64_t n)
+{
+    const access_t *access = arg;
+    uint64_t i;
+    uint64_t sum = 0;
+
+    for (i = 0; i < n; i++)
+        sum += as_read_nommu(&m->root_as, access->addr, access->size, 0);
+
+    sink = sum;
+}
+
+/* Walks in S-mode, over 512 pages of the range so the leaf pte moves */
+static void
+run_mmu(const void *arg, uint64_t n)
+{
+    uint64_t base = *(const uint64_t *)arg;
+    uint64_t i;
+    uint64_t sum = 0;
+
+    switch_to(S_MODE);
+    for (i = 0; i < n; i++) {
+        uint64_t paddr;
+
+        if (mmu(&m->root_as, base + ((i & 511) << 12), &paddr) < 0)
+            panic("%s: fault at 0x%lx\n", __func__, base + ((i & 511) << 12));
+        sum += paddr;
+    }
+    switch_to(M_MODE);
+
+    sink = sum;
+}
+
+static void
+run_csr_read(const void *arg, uint64_t n)
+{
+    uint32_t addr = *(const uint32_t *)arg;
+    uint64_t i;
+    uint64_t sum = 0;
+    bool has_except = false;
+
+    for (i = 0; i < n; i++)
+        sum += csr_read(addr, &has_except);
+
+    if (has_except)
+        panic("%s: csr 0x%x raised an exception\n", __func__, addr);
+
+    sink = sum;
+}
+
+/* Flips one bit with SET and CLEAR, ends with the csr as it was */
+static void
+run_csr_update(const void *arg, uint64_t n)
+{
+    const uint32_t *csr = arg;
+    uint64_t i;
+    uint64_t sum = 0;
+    bool has_except = false;
+
+    for (i = 0; i < n; i++)
+        sum += csr_update(csr[0], csr[1],
+                          (i & 1) ? CSR_OP_CLEAR : CSR_OP_SET, &has_except);
+
+    if (has_except)
+        panic("%s: csr 0x%x raised an exception\n", __func__, csr[0]);
+
+    sink = sum;
+}
+
+/* Publishes @n requests at once, all on descriptor 0, then pops them */
+static void
+run_vqueue_pop(const void *arg, uint64_t n)
+{
+    uint64_t i;
+    uint64_t sum = 0;
+    uint64_t idx = vq.vring.avail + offsetof(vring_avail_t, idx);
+
+    if (n > UINT16_MAX)
+        panic("%s: %lu requests do not fit the avail index\n", __func__, n);
+
+    as_write_nommu(NULL, idx, 2, (uint16_t)(vq.last_avail_idx + n), 0);
+
+    for (i = 0; i < n; i++) {
+        vq_request_t *req = vqueue_pop(&vdev, &vq);
+
+        if (req == NULL)
+            panic("%s: queue empty after %lu\n", __func__, i);
+
+        sum += req->in_len;
+        free(req->iov);
+        free(req);
+    }
+
+    sink = sum;
+}
+
+/*
+ * Setup
+ */
+
+static void
+decode_classes(void)
+{
+    uint32_t i;
+    uint32_t j;
+
+    for (i = 0; i < NR_INSNS32; i++) {
+        uint32_t opcode;
+        op_class_t *cls = NULL;
+        decoded_t *d;
+
+        for (j = 0; j < NR_CLASSES; j++) {
+            if (streq(op_classes[j].name, insns32[i].cls))
+                cls = &op_classes[j];
+        }
+
+        if (cls == NULL)
+            panic("%s: no class %s\n", __func__, insns32[i].cls);
+
+        d = &cls->ops[cls->num++];
+        d->next_pc = decode(RAM_ADDRESS_SPACE_START, insns32[i].inst,
+                            &d->op, &d->rd, &d->rs1, &d->rs2, &d->imm,
+                            &d->csr_addr, &opcode);
+        if (d->op == NOP)
+            panic("%s: %s decodes to nothing\n", __func__, insns32[i].text);
+    }
+}
+
+static void
+write_pte(uint64_t table, uint64_t index, uint64_t pa, uint64_t flags)
+{
+    uint64_t pte = ((pa >> 12) << 10) | flags;
+
+    machine_write_mem(m, table + index * 8, &pte, sizeof(pte));
+}
+
+/*
+ * VA_4K through 4K pages, VA_2M through 2M pages and VA_1G with one
+ * gigapage, all onto the start of ram.
+ */
+static void
+map_init(void)
+{
+    bool has_except = false;
+    uint64_t leaf = PTE_V | PTE_RWX | PTE_AD;
+    uint64_t i;
+
+    write_pte(PT_ROOT, VA_4K >> 30, PT_L1_4K, PTE_V);
+    write_pte(PT_L1_4K, 0, PT_L0_4K, PTE_V);
+    for (i = 0; i < 512; i++)
+        write_pte(PT_L0_4K, i, PAGES + (i << 12), leaf);
+
+    write_pte(PT_ROOT, VA_2M >> 30, PT_L1_2M, PTE_V);
+    for (i = 0; i < 512; i++)
+        write_pte(PT_L1_2M, i, RAM_ADDRESS_SPACE_START + (i << 21), leaf);
+
+    write_pte(PT_ROOT, VA_1G >> 30, RAM_ADDRESS_SPACE_START, leaf);
+
+    csr_update(SATP, SATP_SV39 | (PT_ROOT >> 12), CSR_OP_WRITE, &has_except);
+}
+
+/* A ring at VQ_RING, every head is descriptor 0: header, data, status */
+static void
+vqueue_init(void)
+{
+    vring_desc_t desc[] = {
+        {DATA, 16, VRING_DESC_F_NEXT, 1},
+        {DATA + 0x100, 4096, VRING_DESC_F_NEXT | VRING_DESC_F_WRITE, 2},
+        {DATA + 0x80, 1, VRING_DESC_F_WRITE, 0},
+    };
+    vring_desc_t head = {VQ_TABLE, sizeof(desc), VRING_DESC_F_INDIRECT, 0};
+
+    vdev.guest_features = VIRTIO_RING_F_INDIRECT_DESC;
+
+    vq.vring.num = VQ_NUM;
+    vq.vring.align = 4096;
+    vring_init(&vq.vring, VQ_RING >> 12, 12);
+
+    machine_write_mem(m, VQ_RING, &head, sizeof(head));
+    machine_write_mem(m, VQ_TABLE, desc, sizeof(desc));
+}
+
+static void
+add(const char *name, uint64_t ops,
+    void (*run)(const void *arg, uint64_t n), const void *arg)
+{
+    bench_t *b;
+
+    if (nr_benches == BENCH_MAX)
+        panic("%s: too many benchmarks\n", __func__);
+
+    b = &benches[nr_benches++];
+    b->name = name;
+    b->ops = ops;
+    b->run = run;
+    b->arg = arg;
+}
+
+static void
+bench_init(void)
+{
+    static const uint32_t mscratch = MSCRATCH;
+    static const uint32_t mstatus = MSTATUS;
+    static const uint32_t satp = SATP;
+    static const uint32_t time = TIME;
+    static const uint32_t upd_mscratch[] = {MSCRATCH, 1};
+    static const uint32_t upd_mstatus[] = {MSTATUS, 1 << 18};  /* SUM */
+    static const uint32_t upd_mie[] = {MIE, BIT_SSI};
+    static char names[NR_CLASSES][32];
+    uint32_t i;
+
+    add("dec32", 2000000, run_dec32, NULL);
+    add("dec16", 2000000, run_dec16, NULL);
+
+    for (i = 0; i < NR_CLASSES; i++) {
+        snprintf(names[i], sizeof(names[i]), "execute/%s",
+                 op_classes[i].name);
+        add(names[i], 1000000, run_execute, &op_classes[i]);
+    }
+
+    add("as_read_nommu/ram", 2000000, run_as_read, &access_ram);
+    add("as_read_nommu/uart", 2000000, run_as_read, &access_uart);
+    add("as_read_nommu/rtc", 2000000, run_as_read, &access_rtc);
+    add("as_read_nommu/plic", 2000000, run_as_read, &access_plic);
+    add("as_read_nommu/virtio", 2000000, run_as_read, &access_virtio);
+
+    add("mmu/4k", 1000000, run_mmu, &walk_4k);
+    add("mmu/2m", 1000000, run_mmu, &walk_2m);
+    add("mmu/1g", 1000000, run_mmu, &walk_1g);
+
+    add("csr_read/mscratch", 2000000, run_csr_read, &mscratch);
+    add("csr_read/mstatus", 2000000, run_csr_read, &mstatus);
+    add("csr_read/satp", 2000000, run_csr_read, &satp);
+    add("csr_read/time", 1000000, run_csr_read, &time);
+    add("csr_update/mscratch", 2000000, run_csr_update, upd_mscratch);
+    add("csr_update/mstatus", 2000000, run_csr_update, upd_mstatus);
+    add("csr_update/mie", 2000000, run_csr_update, upd_mie);
+
+    add("vqueue_pop", 50000, run_vqueue_pop, NULL);
+}
+
+static void
+regs_init(void)
+{
+    machine_set_reg(m, REG_T1, DATA);
+    machine_set_reg(m, REG_T2, 3);
+    machine_set_reg(m, REG_A1, DATA);
+    machine_set_reg(m, REG_SP, DATA + 0x200);
+}
+
+/*
+ * Statistics
+ */
+
+static int
+cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void
+measure(bench_t *b, uint32_t rounds)
+{
+    uint32_t i;
+    double sum = 0;
+    double var = 0;
+    double *sorted;
+
+    regs_init();
+
+    /* Warm caches and branch predictors, not counted */
+    b->run(b->arg, b->ops);
+
+    b->ns = calloc(rounds, sizeof(double));
+    for (i = 0; i < rounds; i++) {
+        int64_t start = get_clock();
+
+        b->run(b->arg, b->ops);
+        b->ns[i] = (double)(get_clock() - start) / (double)b->ops;
+        sum += b->ns[i];
+    }
+
+    b->mean = sum / rounds;
+    for (i = 0; i < rounds; i++)
+        var += (b->ns[i] - b->mean) * (b->ns[i] - b->mean);
+    b->stddev = rounds > 1 ? sqrt(var / (rounds - 1)) : 0;
+
+    sorted = malloc(rounds * sizeof(double));
+    memcpy(sorted, b->ns, rounds * sizeof(double));
+    qsort(sorted, rounds, sizeof(double), cmp_double);
+    b->min = sorted[0];
+    b->median = (rounds & 1) ? sorted[rounds / 2] :
+        (sorted[rounds / 2 - 1] + sorted[rounds / 2]) / 2;
+    free(sorted);
+}
+
+/* Median of @name in an earlier run, < 0 if it is not there */
+static double
+baseline(const char *filename, const char *name)
+{
+    FILE *fp;
+    char line[256];
+    double median = -1;
+
+    fp = fopen(filename, "r");
+    if (fp == NULL)
+        panic("%s: cannot open %s\n", __func__, filename);
+
+    while (fgets(line, sizeof(line), fp)) {
+        char bench[64];
+        double v;
+
+        if (sscanf(line, "%63s %*s %*s %lf", bench, &v) == 2 &&
+            streq(bench, name)) {
+            median = v;
+            break;
+        }
+    }
+
+    fclose(fp);
+    return median;
+}
+
+static bool
+selected(const char *name, int argc, char **argv)
+{
+    int i;
+
+    if (optind == argc)
+        return true;
+
+    for (i = optind; i < argc; i++) {
+        if (!strncmp(name, argv[i], strlen(argv[i])))
+            return true;
+    }
+
+    return false;
+}
+
+static void
+usage(const char *name)
+{
+    printf("Usage: %s [options] [filter...]\n"
+           "  -r, --rounds N         timed rounds per benchmark\n"
+           "                         (default: %u)\n"
+           "  -c, --compare FILE     compare medians with an earlier\n"
+           "                         run; exit 1 on a regression\n"
+           "  -t, --threshold PCT    slowdown that counts as one\n"
+           "                         (default: %.0f)\n"
+           "  -l, --list             list the benchmarks\n"
+           "  -h, --help             show this message\n"
+           "\n"
+           "Benchmarks whose name starts with one of the filters run,\n"
+           "all of them without filters.\n",
+           name, DEFAULT_ROUNDS, DEFAULT_THRESH);
+}
+
+static const struct option long_options[] = {
+    {"rounds",      required_argument, NULL, 'r'},
+    {"compare",     required_argument, NULL, 'c'},
+    {"threshold",   required_argument, NULL, 't'},
+    {"list",        no_argument,       NULL, 'l'},
+    {"help",        no_argument,       NULL, 'h'},
+    {NULL, 0, NULL, 0}
+};
+
+int
+main(int argc, char **argv)
+{
+    int c;
+    uint32_t i;
+    uint32_t rounds = DEFAULT_ROUNDS;
+    const char *compare = NULL;
+    double thresh = DEFAULT_THRESH;
+    bool list = false;
+    int status = 0;
+    machine_config cfg;
+
+    while ((c = getopt_long(argc, argv, "r:c:t:lh",
+                            long_options, NULL)) != -1) {
+        switch (c)
+        {
+        case 'r':
+            rounds = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            compare = optarg;
+            break;
+        case 't':
+            thresh = strtod(optarg, NULL);
+            break;
+        case 'l':
+            list = true;
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(0);
+        default:
+            usage(argv[0]);
+            exit(-1);
+        }
+    }
+
+    if (!rounds) {
+        usage(argv[0]);
+        exit(-1);
+    }
+
+    bench_init();
+    if (list) {
+        for (i = 0; i < nr_benches; i++)
+            printf("%s\n", benches[i].name);
+        return 0;
+    }
+
+    machine_config_init(&cfg);
+    cfg.mem_size = 64 << 20;
+    cfg.console = "/dev/null";
+    m = machine_create(&cfg);
+
+    decode_classes();
+    map_init();
+    vqueue_init();
+
+    printf("bench\tops\tmin\tmedian\tmean\tstddev%s\n",
+           compare ? "\tchange" : "");
+
+    for (i = 0; i < nr_benches; i++) {
+        bench_t *b = &benches[i];
+        double base;
+
+        if (!selected(b->name, argc, argv))
+            continue;
+
+        measure(b, rounds);
+        printf("%s\t%lu\t%.2f\t%.2f\t%.2f\t%.2f",
+               b->name, b->ops, b->min, b->median, b->mean, b->stddev);
+
+        if (compare) {
+            base = baseline(compare, b->name);
+            if (base > 0) {
+                double change = (b->median - base) / base * 100;
+
+                printf("\t%+.1f%%", change);
+                if (change > thresh) {
+                    fprintf(stderr, "%s: %s: median %.2f ns/op, was %.2f\n",
+                            argv[0], b->name, b->median, base);
+                    status = 1;
+                }
+            } else {
+                printf("\t-");
+            }
+        }
+
+        printf("\n");
+        fflush(stdout);
+    }
+
+    machine_destroy(m);
+    return status;
+}
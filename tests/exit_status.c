@@ -0,0 +1,35 @@
+/*
+ * Exit status of a finished run
+ */
+
+#include <stdio.h>
+
+#include "../machine.h"
+
+static int failed;
+
+static void
+check(machine_exit_t reason, uint32_t code, int expect)
+{
+    int status = machine_exit_status(reason, code);
+
+    if (status != expect) {
+        printf("reason %d: code 0x%x gives %d, expected %d\n",
+               reason, code, status, expect);
+        failed = 1;
+    }
+}
+
+int main()
+{
+    check(MACHINE_EXIT_PASS, 0, 0);
+    check(MACHINE_EXIT_LIMIT, 0, 0);
+    check(MACHINE_EXIT_FAIL, 0, 1);
+    check(MACHINE_EXIT_FAIL, 3, 3);
+    check(MACHINE_EXIT_FAIL, 0x100, 1);
+    check(MACHINE_EXIT_FAIL, 0x200, 1);
+    check(MACHINE_EXIT_FAIL, 0x1ff, 0xff);
+    check(MACHINE_EXIT_TIMEOUT, 0, MACHINE_STATUS_TIMEOUT);
+
+    return failed;
+}
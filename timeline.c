@@ -0,0 +1,185 @@
+/*
+ * Timeline
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "timeline.h"
+#include "util.h"
+#include "list.h"
+
+#define TIMELINE_EVENTS_INIT    4096
+#define TIMELINE_EVENTS_MAX     (1UL << 22)     /* Per thread */
+
+typedef struct _tl_event {
+    uint64_t    ts;             /* ns, monotonic */
+    const char  *name;
+    const char  *arg_name;
+    uint64_t    arg;
+    char        ph;
+} tl_event;
+
+typedef struct _tl_buf {
+    list_head   entry;
+    uint32_t    tid;
+    const char  *name;
+
+    tl_event    *events;
+    size_t      nr;
+    size_t      cap;
+    uint64_t    dropped;
+} tl_buf;
+
+bool timeline_on;
+
+static const char *timeline_file;
+
+/* Buffers of all threads, only added to until timeline_exit() */
+static LIST_HEAD(buffers);
+static pthread_mutex_t buffers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t next_tid = 1;
+
+static __thread tl_buf *buf;
+
+static tl_buf *
+_get_buf(void)
+{
+    if (buf)
+        return buf;
+
+    buf = calloc(1, sizeof(tl_buf));
+    buf->cap = TIMELINE_EVENTS_INIT;
+    buf->events = malloc(buf->cap * sizeof(tl_event));
+    if (buf->events == NULL)
+        panic("%s: alloc failed\n", __func__);
+
+    pthread_mutex_lock(&buffers_mutex);
+    buf->tid = next_tid++;
+    list_add_tail(&buf->entry, &buffers);
+    pthread_mutex_unlock(&buffers_mutex);
+
+    return buf;
+}
+
+void
+timeline_log(char ph, const char *name, const char *arg_name, uint64_t arg)
+{
+    tl_event *e;
+    tl_buf *b = _get_buf();
+
+    if (b->nr == b->cap) {
+        if (b->cap >= TIMELINE_EVENTS_MAX) {
+            b->dropped++;
+            return;
+        }
+
+        b->cap *= 2;
+        b->events = realloc(b->events, b->cap * sizeof(tl_event));
+        if (b->events == NULL)
+            panic("%s: alloc failed\n", __func__);
+    }
+
+    e = &b->events[b->nr++];
+    e->ts = (uint64_t)get_clock();
+    e->name = name;
+    e->arg_name = arg_name;
+    e->arg = arg;
+    e->ph = ph;
+}
+
+void
+timeline_thread(const char *name)
+{
+    if (timeline_on)
+        _get_buf()->name = name;
+}
+
+void
+timeline_init(const char *filename)
+{
+    if (filename == NULL)
+        return;
+
+    timeline_file = filename;
+    timeline_on = true;
+}
+
+static void
+_write_event(FILE *fp, const tl_buf *b, const tl_event *e, uint64_t base)
+{
+    uint64_t ts = e->ts - base;
+
+    fprintf(fp, ",\n{\"ph\":\"%c\",\"pid\":1,\"tid\":%u,\"ts\":%lu.%03lu",
+            e->ph, b->tid, ts / 1000, ts % 1000);
+
+    if (e->name)
+        fprintf(fp, ",\"name\":\"%s\"", e->name);
+
+    if (e->ph == 'i')
+        fprintf(fp, ",\"s\":\"t\"");
+
+    if (e->arg_name)
+        fprintf(fp, ",\"args\":{\"%s\":\"0x%lx\"}", e->arg_name, e->arg);
+
+    fputc('}', fp);
+}
+
+void
+timeline_exit(void)
+{
+    FILE *fp;
+    tl_buf *b;
+    size_t i;
+    uint64_t nr = 0;
+    uint64_t dropped = 0;
+    uint64_t base = ~0UL;
+
+    if (!timeline_on)
+        return;
+
+    timeline_on = false;
+
+    fp = fopen(timeline_file, "w");
+    if (fp == NULL)
+        panic("%s: cannot open %s\n", __func__, timeline_file);
+
+    list_for_each_entry(b, &buffers, entry) {
+        if (b->nr && b->events[0].ts < base)
+            base = b->events[0].ts;
+    }
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+            "{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\","
+            "\"args\":{\"name\":\"xemu\"}}");
+
+    list_for_each_entry(b, &buffers, entry) {
+        if (b->name)
+            fprintf(fp, ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+                    "\"name\":\"thread_name\",\"args\":{\"name\":\"%s\"}}",
+                    b->tid, b->name);
+
+        for (i = 0; i < b->nr; i++)
+            _write_event(fp, b, &b->events[i], base);
+
+        nr += b->nr;
+        dropped += b->dropped;
+    }
+
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+
+    fprintf(stderr, "timeline: %lu events (%lu dropped) to %s\n",
+            nr, dropped, timeline_file);
+
+    while (!list_empty(&buffers)) {
+        b = list_first_entry(&buffers, tl_buf, entry);
+        list_del(&b->entry);
+        free(b->events);
+        free(b);
+    }
+
+    buf = NULL;
+}
@@ -0,0 +1,57 @@
+/*
+ * Timeline
+ *
+ * Device, interrupt and trap events with host timestamps, written as
+ * Chrome trace event JSON (chrome://tracing, ui.perfetto.dev). Every
+ * thread fills its own buffer, nothing is shared until the file is
+ * written. Off unless timeline_init() is given a file; an event then
+ * costs a test of timeline_on.
+ */
+
+#ifndef _TIMELINE_H_
+#define _TIMELINE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+extern bool timeline_on;
+
+/* Names and @arg_name must be string literals, they are kept as is */
+void
+timeline_log(char ph, const char *name, const char *arg_name, uint64_t arg);
+
+/* Span on the calling thread, ended by the next timeline_end() */
+static inline void
+timeline_begin(const char *name, const char *arg_name, uint64_t arg)
+{
+    if (timeline_on)
+        timeline_log('B', name, arg_name, arg);
+}
+
+static inline void
+timeline_end(void)
+{
+    if (timeline_on)
+        timeline_log('E', NULL, NULL, 0);
+}
+
+static inline void
+timeline_instant(const char *name, const char *arg_name, uint64_t arg)
+{
+    if (timeline_on)
+        timeline_log('i', name, arg_name, arg);
+}
+
+/* Label the calling thread, e.g. at the top of a device thread */
+void
+timeline_thread(const char *name);
+
+/* Once per process, before the first machine */
+void
+timeline_init(const char *filename);
+
+/* After the last machine is gone, writes the file */
+void
+timeline_exit(void);
+
+#endif /* _TIMELINE_H_ */
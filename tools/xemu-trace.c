@@ -0,0 +1,124 @@
+/*
+ * Trace decoder
+ *
+ * Prints a binary trace written by xemu --trace, one line per
+ * instruction: index, pc, raw instruction, op, rd value and the
+ * data address of loads and stores.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "decode.h"
+#include "btrace.h"
+#include "operation.h"
+#include "regfile.h"
+
+static int
+get_varint(FILE *fp, uint64_t *v)
+{
+    int c;
+    uint32_t shift = 0;
+
+    *v = 0;
+    do {
+        if ((c = fgetc(fp)) == EOF || shift > 63)
+            return -1;
+
+        *v |= (uint64_t)(c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+
+    return 0;
+}
+
+static const char *
+rd_name(uint32_t opcode, uint32_t rd, char *buf)
+{
+    if (opcode == OP_LOAD_FP || opcode == OP_FP) {
+        sprintf(buf, "f%u", rd);
+        return buf;
+    }
+
+    return reg_name(rd);
+}
+
+int
+main(int argc, char **argv)
+{
+    FILE *fp;
+    int flags;
+    btrace_header hdr;
+    uint64_t index = 0;
+    uint64_t next_pc = 0;
+    uint64_t prev_addr = 0;
+
+    if (argc != 2) {
+        printf("Usage: %s TRACE\n", argv[0]);
+        exit(-1);
+    }
+
+    fp = fopen(argv[1], "rb");
+    if (fp == NULL || fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        hdr.magic != BTRACE_MAGIC || hdr.version != BTRACE_VERSION) {
+        fprintf(stderr, "%s: bad trace %s\n", argv[0], argv[1]);
+        exit(-1);
+    }
+
+    while ((flags = fgetc(fp)) != EOF) {
+        op_t op;
+        uint32_t rd;
+        uint32_t rs1;
+        uint32_t rs2;
+        uint64_t imm;
+        uint32_t csr_addr;
+        uint32_t opcode;
+        uint64_t v;
+        uint64_t pc = next_pc;
+        uint32_t inst = 0;
+        size_t len = (flags & BTRACE_F_RVC) ? 2 : 4;
+        char buf[8];
+
+        if ((flags & BTRACE_F_JUMP)) {
+            if (get_varint(fp, &v) < 0)
+                break;
+            pc += (uint64_t)btrace_unzigzag(v);
+        }
+
+        if (fread(&inst, len, 1, fp) != 1)
+            break;
+
+        next_pc = pc + len;
+
+        decode(pc, inst, &op, &rd, &rs1, &rs2, &imm, &csr_addr, &opcode);
+
+        if (len == 2)
+            printf("%10lu %16lx:     %04x  %-10s", index, pc, inst, op_name(op));
+        else
+            printf("%10lu %16lx: %08x  %-10s", index, pc, inst, op_name(op));
+
+        if ((flags & BTRACE_F_RD)) {
+            if (get_varint(fp, &v) < 0)
+                break;
+            printf(" %s=0x%lx", rd_name(opcode, rd, buf), v);
+        }
+
+        if ((flags & BTRACE_F_MEM)) {
+            if (get_varint(fp, &v) < 0)
+                break;
+            prev_addr += (uint64_t)btrace_unzigzag(v);
+            printf(" [0x%lx]", prev_addr);
+        }
+
+        printf("\n");
+        index++;
+    }
+
+    if (flags != EOF)
+        fprintf(stderr, "%s: truncated record %lu\n", argv[0], index);
+
+    fclose(fp);
+    return 0;
+}
@@ -5,6 +5,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
+#include <pthread.h>
 
 #include "util.h"
 #include "isa.h"
@@ -15,18 +17,18 @@
 #include "yaml.h"
 #include "system_map.h"
 #include "address_space.h"
+#include "mmu.h"
+#include "machine.h"
+#include "request.h"
+#include "control.h"
 
 typedef struct _watch_item {
     list_head   entry;
     const char  *name;
     char        type;
+    uint64_t    addr;       /* Resolved when trace.yml is parsed */
 } watch_item;
 
-static int trace_decode_en;
-static int trace_execute_en = 0;
-static uint64_t trace_pc_start = 0x80000000;
-static uint64_t trace_pc_end = 0xffffffe00087ccac;
-
 static uint64_t va_pa_offset = 0xffffffe000000000 - 0x80200000;
 
 static inline uint64_t
@@ -35,57 +37,12 @@ va_to_pa(uint64_t va)
     return (va - va_pa_offset);
 }
 
-void
-trace_decode(uint64_t   pc,
-             op_t       op,
-             uint32_t   rd,
-             uint32_t   rs1,
-             uint32_t   rs2,
-             uint64_t   imm,
-             uint32_t   csr_addr)
-{
-    if (!trace_decode_en || pc < trace_pc_start)
-        return;
-
-    fprintf(stderr, "[%lx]: %s; rd: %s; rs1: %s; rs2: %s; imm: %lx\n",
-           pc, op_name(op),
-           reg_name(rd), reg_name(rs1), reg_name(rs2), imm);
-
-    if (op >= CSRRW && op <= CSRRCI)
-        fprintf(stderr, "csr: %s\n\n", csr_name(csr_addr));
-    else
-        fprintf(stderr, "\n");
-}
-
-void
-trace_execute(uint64_t   pc,
-              op_t       op,
-              uint32_t   rd,
-              uint32_t   rs1,
-              uint32_t   rs2,
-              uint64_t   imm,
-              uint32_t   csr_addr)
-{
-    if (!trace_execute_en || pc < trace_pc_start || pc > trace_pc_end)
-        return;
-
-    fprintf(stderr, "[%lx]: %s; rd: %s(0x%0lx); rs1: %s(0x%0lx); rs2: %s(0x%0lx); imm: 0x%0lx\n",
-            pc,
-            op_name(op),
-            reg_name(rd), reg[rd],
-            reg_name(rs1), reg[rs1],
-            reg_name(rs2), reg[rs2],
-            imm);
-
-    if (op >= CSRRW && op <= CSRRCI)
-        fprintf(stderr, "csr: %s\n\n", csr_name(csr_addr));
-    else
-        fprintf(stderr, "\n");
-}
-
-#define TRACE_ITEM_MAXNUM   64
+/* Bits of the pc filter, a miss there rules a pc out at once */
+#define TRACE_FILTER_BITS   16
+#define TRACE_FILTER_SIZE   (1UL << TRACE_FILTER_BITS)
 
 typedef struct _trace_item {
+    list_head   entry;
     const char *name;
     bool        enabled;
     uint64_t    addr;
@@ -95,56 +52,155 @@ typedef struct _trace_item {
     list_head   watch_list;
 } trace_item;
 
-static int trace_num;
-static trace_item trace_table[TRACE_ITEM_MAXNUM];
-static trace_item *item_in_process;
+/*
+ * Items are hashed by pc into buckets, behind a bitmap filter with
+ * one bit per filter slot. A reload of trace.yml builds a new table
+ * and swaps it in; old tables are kept, other machines may be in them.
+ */
+typedef struct _trace_table {
+    list_head   items;
+    size_t      num;
+    trace_item  **buckets;
+    size_t      mask;
+    uint64_t    filter[TRACE_FILTER_SIZE / 64];
+} trace_table;
+
+static trace_table *table;
+
+/* Last item parsed, that keys and values belong to */
+static trace_table *table_in_parse;
+static trace_item *item_in_parse;
+
+__thread bool trace_on;
+
+static __thread trace_item *item_in_process;
+static __thread int ninst_left;
+
+/* Per machine, passed to the control thread and the signal handler */
+typedef struct _trace_ctl {
+    uint32_t    on_req;
+    uint32_t    off_req;
+    uint32_t    toggle_req;
+    uint32_t    reload_req;
+} trace_ctl;
+
+static __thread trace_ctl *ctl;
+
+/* SIGUSR2 toggles tracing of the first machine */
+static machine_t *signal_machine;
+static uint32_t signal_req;
+
+static inline size_t
+_hash_pc(uint64_t pc)
+{
+    return (size_t)((pc >> 1) * 0x9e3779b97f4a7c15UL >> 32);
+}
+
+static inline bool
+_filter_test(trace_table *t, uint64_t pc)
+{
+    size_t bit = _hash_pc(pc) & (TRACE_FILTER_SIZE - 1);
+
+    return t->filter[bit / 64] & (1UL << (bit % 64));
+}
+
+static trace_item *
+_lookup(uint64_t pc)
+{
+    size_t i;
+    trace_table *t = __atomic_load_n(&table, __ATOMIC_ACQUIRE);
+
+    if (!t->num || !_filter_test(t, pc))
+        return NULL;
+
+    for (i = _hash_pc(pc) & t->mask; t->buckets[i];
+         i = (i + 1) & t->mask) {
+        if (t->buckets[i]->addr == pc)
+            return t->buckets[i];
+    }
+
+    return NULL;
+}
 
 static trace_item *
 _match_pc(uint64_t pc)
 {
-    int i;
+    trace_item *item;
 
     if (item_in_process) {
-        if (item_in_process->ninst > 0) {
-            item_in_process->ninst--;
+        if (ninst_left > 0) {
+            ninst_left--;
             return item_in_process;
         }
         item_in_process = NULL;
     }
 
-    for (i = 0; i < trace_num; i++) {
-        trace_item *item = trace_table + i;
-        if (pc == item->addr) {
-            if (item->ninst > 0)
-                item_in_process = item;
-
-            return item;
-        }
+    item = _lookup(pc);
+    if (item && item->ninst > 0) {
+        item_in_process = item;
+        ninst_left = item->ninst;
     }
 
-    return NULL;
+    return item;
+}
+
+static void
+_build_table(trace_table *t)
+{
+    size_t nr_buckets = 16;
+    trace_item *item;
+
+    while (nr_buckets < t->num * 2)
+        nr_buckets *= 2;
+
+    t->buckets = calloc(nr_buckets, sizeof(trace_item *));
+    t->mask = nr_buckets - 1;
+
+    list_for_each_entry(item, &t->items, entry) {
+        size_t i = _hash_pc(item->addr) & t->mask;
+        size_t bit = _hash_pc(item->addr) & (TRACE_FILTER_SIZE - 1);
+
+        while (t->buckets[i])
+            i = (i + 1) & t->mask;
+
+        t->buckets[i] = item;
+        t->filter[bit / 64] |= 1UL << (bit % 64);
+    }
 }
 
+/* A word at a time, translated once per page */
 static void
 _show_string(bool no_mmu, uint64_t addr, const char *name)
 {
-    char c;
-    int i = 0;
+    size_t i = 0;
+    uint64_t paddr = 0;
     char str[256] = {0};
 
-    do {
-        if (no_mmu)
-            c = (char)as_read_nommu(NULL, addr, 1, 0);
-        else
-            c = (char)as_read(NULL, addr, 1, 0, NULL);
+    while (i < sizeof(str) - 1) {
+        uint64_t word;
+        uint64_t base = addr & ~7UL;
+        size_t off = addr & 7UL;
 
-        if (i > 255)
-            panic("%s: string too long %d\n", __func__, i);
+        if (i == 0 || !(base & (PAGE_SIZE - 1))) {
+            paddr = base;
+            if (!no_mmu && mmu(NULL, base, &paddr) < 0)
+                break;
+        }
 
-        str[i++] = c;
-        addr++;
-    } while (c);
+        word = as_read_nommu(NULL, paddr, 8, 0) >> (off * 8);
+        for (; off < 8 && i < sizeof(str) - 1; off++, word >>= 8) {
+            str[i] = (char)word;
+            if (str[i] == '\0')
+                goto out;
+            i++;
+        }
 
+        addr = base + 8;
+        paddr += 8;
+    }
+
+out:
+    str[i] = '\0';
     printf("  %s: %s\n", name, str);
 }
 
@@ -212,6 +268,7 @@ trace(uint64_t pc, op_t op,
         flag = HAS_RD | HAS_RS1;
         break;
     case OP_AUIPC:
+    case OP_LUI:
         printf("  %s %s, 0x%lx",
                op_name(op), reg_name(rd), imm);
         flag = HAS_RD;
@@ -223,6 +280,7 @@ trace(uint64_t pc, op_t op,
         flag = HAS_RS1 | HAS_RS2;
         break;
     case OP_REG:
+    case OP_REG_W:
         printf("  %s %s, %s, %s",
                op_name(op), reg_name(rd), reg_name(rs1), reg_name(rs2));
         flag = HAS_RD | HAS_RS1 | HAS_RS2;
@@ -247,12 +305,10 @@ trace(uint64_t pc, op_t op,
                op_name(op), reg_name(rd), csr_name(csr_addr), reg_name(rs1));
         flag = HAS_RD | HAS_RS1;
         break;
-    case OP_NOP:
+    default:
+        /* Fence, amo and fp: the name only */
         printf("  %s", op_name(op));
         break;
-    default:
-        panic("%s: bad opcode %x for %s\n",
-              __func__, opcode, op_name(op));
     }
 
     if ((inst & 0x3) == 0x3) {
@@ -280,10 +336,7 @@ trace(uint64_t pc, op_t op,
     printf("  tp: 0x%lx\n\n", reg[REG_TP]);
 
     list_for_each_entry(watch, &(item->watch_list), entry) {
-        uint64_t base;
-
-        if (match_in_system_map(watch->name, &base) == NULL)
-            panic("%s: base name %s\n", __func__, watch->name);
+        uint64_t base = watch->addr;
 
         if (item->no_mmu)
             base = va_to_pa(base);
@@ -310,14 +363,21 @@ trace_parse_cb(TOKEN token, const char *key, const char *value)
     switch (token)
     {
     case TOKEN_OBJ:
-        item = &trace_table[trace_num++];
+        item = calloc(1, sizeof(trace_item));
         item->name = match_in_system_map(key, &item->addr);
-        if (item->name == NULL)
-            panic("%s: bad obj %s\n", __func__, item->name);
+        if (item->name == NULL) {
+            free(item);
+            return -1;
+        }
         INIT_LIST_HEAD(&(item->watch_list));
+        list_add_tail(&(item->entry), &table_in_parse->items);
+        item_in_parse = item;
+        table_in_parse->num++;
         break;
     case TOKEN_KV:
-        item = &trace_table[trace_num - 1];
+        item = item_in_parse;
+        if (item == NULL)
+            return -1;
         if (streq(key, "enabled")) {
             item->enabled = streq(value, "true");
         } else if (streq(key, "no_mmu")) {
@@ -337,6 +397,11 @@ trace_parse_cb(TOKEN token, const char *key, const char *value)
                 p->name = strdup(value);
                 p->type = 'd';
             }
+            if (match_in_system_map(p->name, &p->addr) == NULL) {
+                free((char *)p->name);
+                free(p);
+                return -1;
+            }
             list_add_tail(&(p->entry), &(item->watch_list));
         }
         break;
@@ -347,8 +412,178 @@ trace_parse_cb(TOKEN token, const char *key, const char *value)
     return 0;
 }
 
+static void
+_free_table(trace_table *t)
+{
+    list_head *pos;
+    list_head *n;
+    list_head *wpos;
+    list_head *wn;
+
+    list_for_each_safe(pos, n, &t->items) {
+        trace_item *item = list_entry(pos, trace_item, entry);
+
+        list_for_each_safe(wpos, wn, &item->watch_list) {
+            watch_item *watch = list_entry(wpos, watch_item, entry);
+            free((char *)watch->name);
+            free(watch);
+        }
+        free(item);
+    }
+
+    free(t->buckets);
+    free(t);
+}
+
+/* NULL with the reason in @err if trace.yml is bad */
+static trace_table *
+_parse_table(char *err, size_t size)
+{
+    int ret;
+    trace_table *t = calloc(1, sizeof(trace_table));
+
+    INIT_LIST_HEAD(&t->items);
+
+    table_in_parse = t;
+    item_in_parse = NULL;
+    ret = parse_yaml(trace_parse_cb, err, size);
+    table_in_parse = NULL;
+    item_in_parse = NULL;
+
+    if (ret) {
+        _free_table(t);
+        return NULL;
+    }
+
+    _build_table(t);
+    return t;
+}
+
 void
 setup_trace_table(void)
 {
-    parse_yaml(trace_parse_cb);
+    char err[256];
+
+    table = _parse_table(err, sizeof(err));
+    if (table == NULL)
+        panic("%s: %s\n", __func__, err);
+}
+
+int
+trace_reload(char *err, size_t size)
+{
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    trace_table *t;
+
+    /* The parse state is shared, and the old table stays on failure */
+    pthread_mutex_lock(&lock);
+    t = _parse_table(err, size);
+    if (t)
+        __atomic_store_n(&table, t, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&lock);
+
+    if (t == NULL)
+        return -1;
+
+    fprintf(stderr, "trace: %lu trace points\n", t->num);
+    return 0;
+}
+
+static void
+_on_request(void *opaque)
+{
+    trace_on = true;
+}
+
+static void
+_off_request(void *opaque)
+{
+    trace_on = false;
+    item_in_process = NULL;
+}
+
+static void
+_toggle_request(void *opaque)
+{
+    if (trace_on)
+        _off_request(opaque);
+    else
+        _on_request(opaque);
+
+    fprintf(stderr, "trace: %s\n", trace_on ? "on" : "off");
+}
+
+/* The point in process may be gone from the new table */
+static void
+_reload_request(void *opaque)
+{
+    item_in_process = NULL;
+}
+
+static void
+_control_trace(FILE *out, int conn, const char *args, void *opaque)
+{
+    trace_ctl *c = opaque;
+    char err[256];
+
+    if (streq(args, "on")) {
+        request_post(c->on_req);
+    } else if (streq(args, "off")) {
+        request_post(c->off_req);
+    } else if (streq(args, "reload")) {
+        /* Here and not on the cpu, so that a typo is answered, not fatal */
+        if (trace_reload(err, sizeof(err))) {
+            fprintf(out, "error: %s\n", err);
+            return;
+        }
+        request_post(c->reload_req);
+    } else {
+        fprintf(out, "error: usage: trace on|off|reload\n");
+        return;
+    }
+
+    fprintf(out, "ok\n");
+}
+
+static void
+_signal(int sig)
+{
+    machine_t *m = signal_machine;
+
+    if (m)
+        __atomic_or_fetch(&m->requests, signal_req, __ATOMIC_SEQ_CST);
+}
+
+void
+trace_init(bool on)
+{
+    trace_on = on;
+    item_in_process = NULL;
+
+    ctl = calloc(1, sizeof(trace_ctl));
+    ctl->on_req = request_register(_on_request, NULL);
+    ctl->off_req = request_register(_off_request, NULL);
+    ctl->toggle_req = request_register(_toggle_request, NULL);
+    ctl->reload_req = request_register(_reload_request, NULL);
+
+    control_register("trace", "trace points on|off, or reload trace.yml",
+                     _control_trace, ctl);
+
+    if (__sync_bool_compare_and_swap(&signal_machine, NULL, _machine)) {
+        signal_req = ctl->toggle_req;
+        signal(SIGUSR2, _signal);
+    }
+}
+
+void
+trace_exit(void)
+{
+    if (signal_machine == _machine) {
+        signal(SIGUSR2, SIG_IGN);
+        signal_machine = NULL;
+    }
+
+    free(ctl);
+    ctl = NULL;
+    trace_on = false;
 }
@@ -6,26 +6,16 @@
 #define _TRACE_H_
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
 
 #include "operation.h"
 
-void
-trace_decode(uint64_t   pc,
-             op_t       op,
-             uint32_t   rd,
-             uint32_t   rs1,
-             uint32_t   rs2,
-             uint64_t   imm,
-             uint32_t   csr_addr);
-
-void
-trace_execute(uint64_t   pc,
-              op_t       op,
-              uint32_t   rd,
-              uint32_t   rs1,
-              uint32_t   rs2,
-              uint64_t   imm,
-              uint32_t   csr_addr);
+/*
+ * Trace points from conf/trace.yml. Checked only by the instrumented
+ * run loop, which the machine switches to while trace_on is set.
+ */
+extern __thread bool trace_on;
 
 void
 trace(uint64_t pc, op_t op,
@@ -36,4 +26,21 @@ trace(uint64_t pc, op_t op,
 void
 setup_trace_table(void);
 
+/*
+ * Parse trace.yml again and swap the table in. On a bad file the old
+ * table stays and -1 comes back with the reason in @err.
+ */
+int
+trace_reload(char *err, size_t size);
+
+/*
+ * Per machine: "trace on|off|reload" on the control socket, and
+ * SIGUSR2 to toggle the first machine
+ */
+void
+trace_init(bool on);
+
+void
+trace_exit(void);
+
 #endif /* _TRACE_H_ */
@@ -4,6 +4,60 @@
 
 #include "trap.h"
 #include "device.h"
+#include "stats.h"
+#include "flight.h"
+#include "timeline.h"
+#include "metrics.h"
+#include "irqlat.h"
+#include "probes.h"
+#include "bootphase.h"
+
+static const char *except_names[16] = {
+    [CAUSE_INST_ADDR_MISALIGNED]    = "inst misaligned",
+    [CAUSE_INST_ACCESS_FAULT]       = "inst access fault",
+    [CAUSE_ILLEGAL_INST]            = "illegal inst",
+    [CAUSE_BREAK_POINT]             = "breakpoint",
+    [CAUSE_LOAD_ADDR_MISALIGNED]    = "load misaligned",
+    [CAUSE_LOAD_ACCESS_FAULT]       = "load access fault",
+    [CAUSE_STORE_ADDR_MISALIGNED]   = "store misaligned",
+    [CAUSE_STORE_ACCESS_FAULT]      = "store access fault",
+    [CAUSE_ECALL_FROM_U_MODE]       = "ecall from U",
+    [CAUSE_ECALL_FROM_S_MODE]       = "ecall from S",
+    [CAUSE_ECALL_FROM_M_MODE]       = "ecall from M",
+    [CAUSE_INST_PAGE_FAULT]         = "inst page fault",
+    [CAUSE_LOAD_PAGE_FAULT]         = "load page fault",
+    [CAUSE_STORE_PAGE_FAULT]        = "store page fault",
+};
+
+static const char *intr_names[16] = {
+    [CAUSE_U_SOFTWARE_INTR & 0xF]   = "U software irq",
+    [CAUSE_S_SOFTWARE_INTR & 0xF]   = "S software irq",
+    [CAUSE_M_SOFTWARE_INTR & 0xF]   = "M software irq",
+    [CAUSE_U_TIMER_INTR & 0xF]      = "U timer irq",
+    [CAUSE_S_TIMER_INTR & 0xF]      = "S timer irq",
+    [CAUSE_M_TIMER_INTR & 0xF]      = "M timer irq",
+    [CAUSE_U_EXTERNAL_INTR & 0xF]   = "U external irq",
+    [CAUSE_S_EXTERNAL_INTR & 0xF]   = "S external irq",
+    [CAUSE_M_EXTERNAL_INTR & 0xF]   = "M external irq",
+};
+
+static const char *
+_cause_name(uint64_t cause)
+{
+    const char *name;
+
+    if (cause & BIT_CAUSE_INTR)
+        name = intr_names[cause & 0xF];
+    else
+        name = except_names[cause & 0xF];
+
+    return name ? name : "trap";
+}
+
+__thread uint64_t trap_count;
+
+/* Open timeline spans, the first mret or sret into a mode has none */
+static __thread uint32_t trap_spans;
 
 uint64_t
 trap_enter(uint64_t pc, uint32_t next_priv, uint64_t cause, uint64_t tval)
@@ -11,6 +65,14 @@ trap_enter(uint64_t pc, uint32_t next_priv, uint64_t cause, uint64_t tval)
     uint64_t ret;
     bool has_except = false;
 
+    trap_count++;
+    stats_trap(cause, priv());
+    flight_log(FLIGHT_TRAP, pc, 0, cause, tval);
+    timeline_begin(_cause_name(cause), "pc", pc);
+    trap_spans++;
+    metrics_traps[cause >> 63][cause & 0xF]++;
+    PROBE4(trap_enter, pc, cause, tval, next_priv);
+
     if (next_priv == S_MODE) {
         /* Handle trap in S_MODE */
         uint64_t mode_bit = (priv() == U_MODE) ? 0UL : 1UL;
@@ -57,6 +119,11 @@ trap_exit(op_t op)
     uint64_t mstatus;
     bool has_except = false;
 
+    if (trap_spans) {
+        trap_spans--;
+        timeline_end();
+    }
+
     switch (op)
     {
     case SRET:
@@ -65,6 +132,7 @@ trap_exit(op_t op)
         SET_BIT(sstatus, BIT_SIE_POS, BIT(sstatus, BIT_SPIE_POS));
         csr_update(SSTATUS, sstatus, CSR_OP_WRITE, &has_except);
         ret = csr_read(SEPC, &has_except);
+        bootphase_priv(priv());
         break;
 
     case MRET:
@@ -73,12 +141,14 @@ trap_exit(op_t op)
         SET_BIT(mstatus, BIT_MIE_POS, BIT(mstatus, BIT_MPIE_POS));
         csr_update(MSTATUS, mstatus, CSR_OP_WRITE, &has_except);
         ret = csr_read(MEPC, &has_except);
+        bootphase_priv(priv());
         break;
 
     default:
         panic("%s: bad op(0x%x)\n", __func__, op);
     }
 
+    PROBE1(trap_exit, ret);
     return ret;
 }
 
@@ -89,6 +159,7 @@ handle_interrupt(uint64_t pc)
     uint64_t ret_pc = 0;
     bool has_except = false;
     uint32_t eid = 0;
+    uint32_t src;
     intr_type_t type = INTR_TYPE_NONE;
 
     /* Source */
@@ -101,6 +172,11 @@ handle_interrupt(uint64_t pc)
     if (!type)
         return 0;
 
+    if (type == EXTERNAL_INTR_TYPE)
+        src = IRQLAT_PLIC(eid);
+    else
+        src = (type == TIMER_INTR_TYPE) ? IRQLAT_TIMER : IRQLAT_SOFT;
+
     /* Target */
     next_priv = intr_next_priv(type, priv());
     if (next_priv == S_MODE) {
@@ -110,6 +186,7 @@ handle_interrupt(uint64_t pc)
             uint32_t irq_bit = intr_bit_flag(type, S_MODE);
             if (sie & irq_bit) {
                 csr_update(SIP, irq_bit, CSR_OP_SET, &has_except);
+                irqlat_taken(src, next_priv);
                 ret_pc = trap_enter(pc, next_priv,
                                     intr_cause(type, next_priv), 0);
             }
@@ -121,6 +198,7 @@ handle_interrupt(uint64_t pc)
             uint32_t irq_bit = intr_bit_flag(type, M_MODE);
             if (mie & irq_bit) {
                 csr_update(MIP, irq_bit, CSR_OP_SET, &has_except);
+                irqlat_taken(src, next_priv);
                 ret_pc = trap_enter(pc, next_priv,
                                     intr_cause(type, next_priv), 0);
             }
@@ -11,6 +11,9 @@
 #include "csr.h"
 #include "operation.h"
 
+/* Traps taken by this hart, an instruction that trapped did not retire */
+extern __thread uint64_t trap_count;
+
 uint64_t
 trap_enter(uint64_t pc, uint32_t next_priv, uint64_t cause, uint64_t tval);
 
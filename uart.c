@@ -8,6 +8,9 @@
 
 #include "device.h"
 #include "util.h"
+#include "snapshot.h"
+#include "replay.h"
+#include "machine.h"
 
 #define UART_ADDRESS_SPACE_START 0x0000000010000000
 #define UART_ADDRESS_SPACE_END   0x00000000100000FF
@@ -53,6 +56,10 @@ typedef struct _uart_t
 {
     device_t dev;
 
+    pthread_t tid;
+    bool    input;      /* Reading stdin in tid */
+    FILE    *out;       /* Console output, stdout by default */
+
     uint32_t irq_num;
 
     uint8_t rbr;
@@ -137,8 +144,9 @@ uart_write(void *dev, uint64_t addr, uint64_t data, size_t size,
             uart->divider = (uint16_t)((uart->divider & 0xFF00) | (data & 0xFF));
         } else {
             uart->thr_pending = false;
-            putchar((uint8_t)data);
-            fflush(stdout);
+            fputc((uint8_t)data, uart->out);
+            if (uart->out == stdout)
+                fflush(stdout);
         }
         break;
 
@@ -197,37 +205,74 @@ uart_write(void *dev, uint64_t addr, uint64_t data, size_t size,
     return 0;
 }
 
+static void
+_receive(uint64_t data, void *opaque)
+{
+    uart_t *uart = (uart_t *) opaque;
+
+    uart->rbr = (uint8_t)data;
+
+    uart->lsr |= UART_LSR_DR;
+    if (uart->ier & UART_IER_RDI) {
+        uart->iir = UART_IIR_RDI;
+        plic_signal(uart->irq_num);
+    }
+}
+
 static void *
 _routine(void *arg)
 {
     uart_t *uart = (uart_t *) arg;
 
     while (1) {
-        uart->rbr = getch();
-        if (uart->rbr == 3) /* CTRL_C */
+        uint8_t c = getch();
+        if (c == 3 || feof(stdin)) /* CTRL_C or no more input */
             break;
 
-        uart->lsr |= UART_LSR_DR;
-        if (uart->ier & UART_IER_RDI) {
-            uart->iir = UART_IIR_RDI;
-            plic_signal(uart->irq_num);
-        }
+        if (replay_mode == REPLAY_RECORD)
+            replay_async(REPLAY_UART_INPUT, c);
+        else
+            _receive(c, uart);
     }
 
     return NULL;
 }
 
+static void
+_uart_release(device_t *dev)
+{
+    uart_t *uart = (uart_t *) dev;
+
+    if (uart->input) {
+        pthread_cancel(uart->tid);
+        pthread_join(uart->tid, NULL);
+    }
+
+    if (uart->out != stdout)
+        fclose(uart->out);
+
+    free(uart);
+}
+
 device_t *
-uart_init(address_space *parent_as, uint32_t irq_num)
+uart_init(address_space *parent_as, uint32_t irq_num, bool input,
+          const char *console)
 {
-    pthread_t tid;
     uart_t *uart;
 
     uart = calloc(1, sizeof(uart_t));
     uart->dev.name = "uart";
+    uart->dev.release = _uart_release;
 
     uart->irq_num = irq_num;
 
+    uart->out = stdout;
+    if (console) {
+        uart->out = fopen(console, "w");
+        if (uart->out == NULL)
+            panic("%s: cannot open %s\n", __func__, console);
+    }
+
     uart->lsr = UART_LSR_THRE | UART_LSR_TEMT;
 
     init_address_space(&(uart->dev.as),
@@ -241,7 +286,15 @@ uart_init(address_space *parent_as, uint32_t irq_num)
 
     register_address_space(parent_as, &(uart->dev.as));
 
-    pthread_create(&tid, NULL, _routine, uart);
+    snapshot_register("uart", &uart->irq_num,
+                      sizeof(uart_t) - offsetof(uart_t, irq_num), NULL, NULL);
+
+    /* On replay, input comes from the log instead of stdin */
+    replay_register(REPLAY_UART_INPUT, _receive, uart);
+    if (input && replay_mode != REPLAY_PLAY) {
+        uart->input = true;
+        machine_thread_create(&uart->tid, "uart", _routine, uart);
+    }
 
     return (device_t *) uart;
 }
@@ -0,0 +1,232 @@
+/*
+ * Lazy ram population with userfaultfd
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/userfaultfd.h>
+
+#include "util.h"
+#include "uffd.h"
+
+typedef struct _uffd_t {
+    int         uffd;
+    int         fd;
+    uint64_t    offset;
+
+    uint8_t     *base;
+    size_t      size;
+
+    uint32_t    *hot;
+    size_t      nr_hot;
+
+    uint64_t    *filled;    /* Bitmap of pages that are in place */
+    volatile bool stopping; /* uffd_stop(), prefetch gives up */
+    volatile bool closing;  /* Faults now resolve to zero by the kernel */
+    volatile bool done;
+
+    pthread_t   fault_tid;
+    pthread_t   prefetch_tid;
+} uffd_t;
+
+static bool
+_test_and_set(uint64_t *bitmap, size_t index)
+{
+    uint64_t bit = 1UL << (index % 64);
+    uint64_t old = __atomic_fetch_or(&bitmap[index / 64], bit,
+                                     __ATOMIC_SEQ_CST);
+    return (old & bit) != 0;
+}
+
+static bool
+_is_zero(const uint8_t *page)
+{
+    size_t i;
+    const uint64_t *p = (const uint64_t *)page;
+
+    for (i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+        if (p[i])
+            return false;
+    }
+
+    return true;
+}
+
+/* Both threads may race for a page; the kernel tells the loser EEXIST. */
+static void
+_fill_page(uffd_t *u, size_t index, uint8_t *buf)
+{
+    uint64_t dst = (uint64_t)(u->base + index * PAGE_SIZE);
+    ssize_t ret;
+
+    if (_test_and_set(u->filled, index))
+        return;
+
+    ret = pread(u->fd, buf, PAGE_SIZE, (off_t)(u->offset + index * PAGE_SIZE));
+    if (ret < 0)
+        panic("%s: read page 0x%lx failed\n", __func__, index);
+
+    if (ret < (ssize_t)PAGE_SIZE)
+        memset(buf + ret, 0, PAGE_SIZE - (size_t)ret);
+
+    if (_is_zero(buf)) {
+        struct uffdio_zeropage zero = {
+            .range = { .start = dst, .len = PAGE_SIZE },
+        };
+        if (ioctl(u->uffd, UFFDIO_ZEROPAGE, &zero) < 0 &&
+            errno != EEXIST && !u->closing)
+            panic("%s: zero page 0x%lx failed\n", __func__, index);
+    } else {
+        struct uffdio_copy copy = {
+            .dst = dst,
+            .src = (uint64_t)buf,
+            .len = PAGE_SIZE,
+        };
+        if (ioctl(u->uffd, UFFDIO_COPY, &copy) < 0 &&
+            errno != EEXIST && !u->closing)
+            panic("%s: copy page 0x%lx failed\n", __func__, index);
+    }
+}
+
+static void *
+_fault_routine(void *arg)
+{
+    uffd_t *u = (uffd_t *) arg;
+    uint8_t *buf = aligned_alloc(PAGE_SIZE, PAGE_SIZE);
+
+    while (!u->closing) {
+        struct uffd_msg msg;
+        struct pollfd pfd = { .fd = u->uffd, .events = POLLIN };
+
+        if (poll(&pfd, 1, 100) <= 0)
+            continue;
+
+        if (read(u->uffd, &msg, sizeof(msg)) != sizeof(msg))
+            continue;
+
+        if (msg.event != UFFD_EVENT_PAGEFAULT)
+            continue;
+
+        _fill_page(u, (msg.arg.pagefault.address - (uint64_t)u->base) >>
+                   PAGE_SHIFT, buf);
+    }
+
+    free(buf);
+    return NULL;
+}
+
+static void *
+_prefetch_routine(void *arg)
+{
+    size_t i;
+    off_t data;
+    off_t hole;
+    uffd_t *u = (uffd_t *) arg;
+    uint8_t *buf = aligned_alloc(PAGE_SIZE, PAGE_SIZE);
+    int64_t start = get_clock();
+    struct uffdio_range range = {
+        .start = (uint64_t)u->base,
+        .len = u->size,
+    };
+
+    for (i = 0; i < u->nr_hot && !u->stopping; i++) {
+        if (u->hot[i] < u->size >> PAGE_SHIFT)
+            _fill_page(u, u->hot[i], buf);
+    }
+
+    /* Then the cold pages, skipping holes of the image */
+    data = (off_t)u->offset;
+    while (!u->stopping && (data = lseek(u->fd, data, SEEK_DATA)) >= 0) {
+        if ((uint64_t)data >= u->offset + u->size)
+            break;
+
+        hole = lseek(u->fd, data, SEEK_HOLE);
+        if ((uint64_t)hole > u->offset + u->size)
+            hole = (off_t)(u->offset + u->size);
+
+        for (i = ((uint64_t)data - u->offset) >> PAGE_SHIFT;
+             i < (((uint64_t)hole - u->offset) + PAGE_SIZE - 1) >> PAGE_SHIFT &&
+             !u->stopping;
+             i++)
+            _fill_page(u, i, buf);
+
+        data = hole;
+    }
+
+    /* Holes are zero, which is what plain anonymous memory gives. */
+    u->closing = true;
+    if (ioctl(u->uffd, UFFDIO_UNREGISTER, &range) < 0)
+        panic("%s: unregister failed\n", __func__);
+
+    u->done = true;
+
+    if (!u->stopping)
+        printf("%s: ram populated in %ld ms\n",
+               __func__, (get_clock() - start) / 1000000);
+
+    free(buf);
+    return NULL;
+}
+
+uffd_t *
+uffd_restore(uint8_t *base, size_t size, int fd, uint64_t offset,
+             uint32_t *hot, size_t nr_hot)
+{
+    uffd_t *u;
+    struct uffdio_api api = { .api = UFFD_API };
+    struct uffdio_register reg = {
+        .range = { .start = (uint64_t)base, .len = size },
+        .mode = UFFDIO_REGISTER_MODE_MISSING,
+    };
+
+    u = calloc(1, sizeof(uffd_t));
+    u->fd = fd;
+    u->offset = offset;
+    u->base = base;
+    u->size = size;
+    u->hot = hot;
+    u->nr_hot = nr_hot;
+    u->filled = calloc((size >> PAGE_SHIFT) / 64 + 1, sizeof(uint64_t));
+
+    u->uffd = (int)syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+    if (u->uffd < 0)
+        panic("%s: userfaultfd not available\n", __func__);
+
+    if (ioctl(u->uffd, UFFDIO_API, &api) < 0 ||
+        ioctl(u->uffd, UFFDIO_REGISTER, &reg) < 0)
+        panic("%s: register ram failed\n", __func__);
+
+    pthread_create(&u->fault_tid, NULL, _fault_routine, u);
+    pthread_create(&u->prefetch_tid, NULL, _prefetch_routine, u);
+
+    return u;
+}
+
+bool
+uffd_active(uffd_t *u)
+{
+    return u && !u->done;
+}
+
+void
+uffd_stop(uffd_t *u)
+{
+    /* Prefetch unregisters on its way out, that ends the fault thread */
+    u->stopping = true;
+    pthread_join(u->prefetch_tid, NULL);
+    pthread_join(u->fault_tid, NULL);
+
+    close(u->uffd);
+    free(u->filled);
+    free(u->hot);
+    free(u);
+}
@@ -0,0 +1,36 @@
+/*
+ * Lazy ram population with userfaultfd
+ */
+
+#ifndef _UFFD_H_
+#define _UFFD_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct _uffd_t uffd_t;
+
+/*
+ * Fill [base, base + size) from @fd at @offset when pages are first
+ * touched. A prefetcher fills @hot pages first, then everything else
+ * that has data in @fd; after that ram is plain anonymous memory.
+ * The range must be private anonymous memory that nobody touched yet.
+ * Takes @hot, @fd stays the caller's and must outlive uffd_stop().
+ */
+uffd_t *
+uffd_restore(uint8_t *base, size_t size, int fd, uint64_t offset,
+             uint32_t *hot, size_t nr_hot);
+
+/* True until every page with data has been filled */
+bool
+uffd_active(uffd_t *u);
+
+/*
+ * Stop and join the threads and free @u. Pages not filled yet read
+ * as zero afterwards, so this is for when ram goes away.
+ */
+void
+uffd_stop(uffd_t *u);
+
+#endif /* _UFFD_H_ */
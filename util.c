@@ -2,22 +2,27 @@
  * Util
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <errno.h>
 #include <time.h>
 #include <termio.h>
 #include <sys/time.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 
 #include "util.h"
+#include "snapshot.h"
+#include "machine.h"
+#include "regfile.h"
+#include "flight.h"
 
 #define NANOSECONDS_PER_SECOND 1000000000LL
 #define XEMU_CLINT_TIMEBASE_FREQ 10000000
 
-extern uint64_t _pc;
-static int64_t cpu_clock_offset;
-
 void
 panic(const char *msg, ...)
 {
@@ -30,6 +35,8 @@ panic(const char *msg, ...)
     fprintf(stderr, "System exit ...\n");
     fprintf(stderr, "#############################\n\n");
 
+    flight_crash("panic");
+
     exit(-1);
 }
 
@@ -49,16 +56,38 @@ get_clock_realtime(void)
     return tv.tv_sec * 1000000000LL + (tv.tv_usec * 1000);
 }
 
+static void
+_clock_pre_save(void *opaque)
+{
+    _machine->clock_saved = cpu_get_clock();
+}
+
+/* Guest time goes on from where it was saved */
+static void
+_clock_post_load(void *opaque)
+{
+    _machine->clock_offset = _machine->clock_saved - get_clock();
+}
+
+static const snapshot_ops clock_ops = {
+    .pre_save = _clock_pre_save,
+    .post_load = _clock_post_load,
+};
+
 void
 cpu_enable_clock(void)
 {
-    cpu_clock_offset -= get_clock();
+    _machine->clock_offset = -get_clock();
+
+    snapshot_register("cpu.clock", &_machine->clock_saved,
+                      sizeof(_machine->clock_saved), &clock_ops, NULL);
 }
 
+/* Also called by device threads, so it lives in the machine */
 int64_t
 cpu_get_clock(void)
 {
-    return cpu_clock_offset + get_clock();
+    return _machine->clock_offset + get_clock();
 }
 
 /* compute with 96 bit intermediate result: (a*b)/c */
@@ -76,6 +105,106 @@ cpu_read_rtc(void)
                     NANOSECONDS_PER_SECOND);
 }
 
+/* Parse sizes like "512M" or "16G" */
+uint64_t
+parse_size(const char *str)
+{
+    char *end;
+    uint32_t shift = 0;
+    uint64_t size;
+
+    errno = 0;
+    size = strtoull(str, &end, 0);
+    if (end == str || errno)
+        panic("%s: bad size '%s'\n", __func__, str);
+
+    switch (*end)
+    {
+    case 'T':
+    case 't':
+        shift += 10;
+        /* fall through */
+    case 'G':
+    case 'g':
+        shift += 10;
+        /* fall through */
+    case 'M':
+    case 'm':
+        shift += 10;
+        /* fall through */
+    case 'K':
+    case 'k':
+        shift += 10;
+        end++;
+        break;
+    default:
+        break;
+    }
+
+    /* Or wraps once the suffix is applied, e.g. 99999999999G */
+    if (*end != '\0' || size > (UINT64_MAX >> shift))
+        panic("%s: bad size '%s'\n", __func__, str);
+
+    return size << shift;
+}
+
+int
+seal_buffer(const char *name, const void *ptr, size_t size)
+{
+    size_t done = 0;
+    int fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+    if (fd < 0)
+        panic("%s: memfd for %s failed\n", __func__, name);
+
+    while (done < size) {
+        ssize_t ret = write(fd, (const uint8_t *)ptr + done, size - done);
+        if (ret <= 0)
+            panic("%s: write %s failed\n", __func__, name);
+
+        done += (size_t)ret;
+    }
+
+    /* Private mappings may still write, into their own copies */
+    if (fcntl(fd, F_ADD_SEALS,
+              F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0)
+        panic("%s: seal %s failed\n", __func__, name);
+
+    return fd;
+}
+
+uint8_t *
+map_cow(int fd, size_t size)
+{
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (ptr == MAP_FAILED)
+        panic("%s: mmap 0x%lx failed\n", __func__, size);
+
+    return ptr;
+}
+
+FILE *
+report_open(const char *filename)
+{
+    FILE *fp;
+
+    if (streq(filename, "-"))
+        return stderr;
+
+    fp = fopen(filename, "a");
+    if (fp == NULL)
+        fprintf(stderr, "%s: cannot open %s\n", __func__, filename);
+
+    return fp;
+}
+
+void
+report_close(FILE *fp)
+{
+    if (fp != stderr)
+        fclose(fp);
+}
+
 #if 0
 uint8_t
 getch(void)
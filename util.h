@@ -140,6 +140,24 @@ cpu_read_rtc(void);
 uint8_t
 getch(void);
 
+uint64_t
+parse_size(const char *str);
+
+/* Copy @size bytes at @ptr into a memfd sealed against any change */
+int
+seal_buffer(const char *name, const void *ptr, size_t size);
+
+/* Private writable view of a sealed buffer, pages are shared until written */
+uint8_t *
+map_cow(int fd, size_t size);
+
+/* Report to append to @filename, stderr for "-", NULL if it cannot open */
+FILE *
+report_open(const char *filename);
+
+void
+report_close(FILE *fp);
+
 static inline bool
 streq(const char *str, const char *val)
 {
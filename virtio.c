@@ -9,6 +9,7 @@
 
 #include "virtio.h"
 #include "address_space.h"
+#include "probes.h"
 
 static inline uint16_t
 vring_avail_idx(vqueue_t *vq)
@@ -123,6 +124,7 @@ vqueue_pop(virtio_dev_t *vdev, vqueue_t *vq)
 {
     uint32_t head;
     vring_desc_t desc;
+    vq_request_t *req;
 
     if (virtio_queue_empty(vq))
         return NULL;
@@ -136,7 +138,9 @@ vqueue_pop(virtio_dev_t *vdev, vqueue_t *vq)
     vring_desc_read(vq, head, &desc);
 
     if (desc.flags & VRING_DESC_F_INDIRECT) {
-        return vring_desc_read_indirect(head, desc.addr, desc.len);
+        req = vring_desc_read_indirect(head, desc.addr, desc.len);
+        PROBE2(vq_pop, head, req->in_len);
+        return req;
     } else {
         panic("%s: now only support indirect desc table!\n", __func__);
     }
@@ -182,4 +186,5 @@ vring_used_write(vqueue_t *vq, vq_request_t *req)
 
     vq->used_idx++;
     vring_used_idx_set(vq, vq->used_idx);
+    PROBE2(vq_complete, req->index, req->in_len);
 }
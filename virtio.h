@@ -253,6 +253,8 @@ typedef struct _virtio_dev_t
 
     int (*handle_request)(struct _virtio_dev_t *vdev, vq_request_t *req);
 
+    void (*release)(struct _virtio_dev_t *vdev);
+
 } virtio_dev_t;
 
 
@@ -12,6 +12,11 @@
 #include "virtio.h"
 #include "address_space.h"
 #include "device.h"
+#include "snapshot.h"
+#include "replay.h"
+#include "machine.h"
+#include "timeline.h"
+#include "metrics.h"
 
 /* Feature bits */
 #define VIRTIO_BLK_F_BARRIER        0x1     /* Does host support barriers? */
@@ -79,16 +84,40 @@ typedef struct _virtio_blk_outhdr {
     uint64_t sector;
 } virtio_blk_outhdr;
 
+/* Latency buckets are powers of 2 in us, the last one is +Inf */
+#define BLK_LATENCY_BUCKETS 21
+
+enum {
+    BLK_OP_READ = 0,
+    BLK_OP_WRITE,
+    BLK_OP_FLUSH,
+    BLK_OP_MAX,
+};
+
+static const char *blk_op_names[BLK_OP_MAX] = { "read", "write", "flush" };
+
 typedef struct _virtio_blk_t
 {
     virtio_dev_t vdev;
 
+    pthread_t tid;
     pthread_mutex_t _mutex;
     pthread_cond_t _cond;
+    bool exiting;
 
     vq_request_t *_req;
+    bool _busy;             /* Worker has a request in hand, under _mutex */
 
     const char *filename;
+
+    int64_t submit_ns;      /* Of _req, under _mutex */
+    int64_t start_ns;       /* Of the request in progress */
+
+    /* Written by whichever thread completes the request */
+    uint64_t ops[BLK_OP_MAX];
+    uint64_t bytes[BLK_OP_MAX];
+    uint64_t latency[BLK_LATENCY_BUCKETS];
+    uint64_t latency_ns;
 } virtio_blk_t;
 
 typedef struct _virtio_blk_config_t
@@ -232,11 +261,20 @@ virtio_blk_get_features()
 static void
 _complete(virtio_blk_t *blk, vq_request_t *req)
 {
+    uint32_t i = 0;
+    uint64_t ns = (uint64_t)(get_clock() - blk->start_ns);
+
+    while (i < BLK_LATENCY_BUCKETS - 1 && ns >= (1000UL << i))
+        i++;
+    blk->latency[i]++;
+    blk->latency_ns += ns;
+
     as_write_nommu(NULL, req->iov[req->num-1].base, 1, VIRTIO_BLK_S_OK, 0);
 
     vring_used_write(blk->vdev.vq, req);
 
     blk->vdev.isr |= 0x1;
+    timeline_instant("blk complete", "desc", req->index);
     plic_signal(blk->vdev.irq_num);
 }
 
@@ -259,7 +297,10 @@ _handle_read(virtio_blk_t *blk, vq_request_t *req, uint64_t sector)
         panic("%s: cannot seek sector(%u) of file %s\n",
               __func__, sector, blk->filename);
 
+    blk->ops[BLK_OP_READ]++;
+
     for (i = 1; i < (req->num - 1); i++) {
+        blk->bytes[BLK_OP_READ] += req->iov[i].len;
         data = malloc(req->iov[i].len);
 
         if (fread(data, 1, req->iov[i].len, fp) != req->iov[i].len)
@@ -285,6 +326,9 @@ _handle_write(virtio_blk_t *blk, vq_request_t *req, uint64_t sector)
     if (req->num != 3)
         panic("%s: bad request number %d\n", __func__, req->num);
 
+    blk->ops[BLK_OP_WRITE]++;
+    blk->bytes[BLK_OP_WRITE] += req->iov[1].len;
+
     data = malloc(req->iov[1].len);
     as_read_blob(req->iov[1].base, req->iov[1].len, data);
 
@@ -313,6 +357,7 @@ _handle_flush(virtio_blk_t *blk, vq_request_t *req)
     if (req->num != 2)
         panic("%s: bad request number %d\n", __func__, req->num);
 
+    blk->ops[BLK_OP_FLUSH]++;
     _complete(blk, req);
     return 0;
 }
@@ -358,15 +403,29 @@ _routine(void *arg)
 
         pthread_mutex_lock(&blk->_mutex);
 
-        while (blk->_req == NULL)
+        while (blk->_req == NULL && !blk->exiting)
             pthread_cond_wait(&blk->_cond, &blk->_mutex);
 
+        if (blk->exiting) {
+            pthread_mutex_unlock(&blk->_mutex);
+            break;
+        }
+
         req = blk->_req;
         blk->_req = NULL;
+        blk->_busy = true;
+        blk->start_ns = blk->submit_ns;
 
         pthread_mutex_unlock(&blk->_mutex);
 
+        timeline_begin("blk request", "desc", req->index);
         _do_request(blk, req);
+        timeline_end();
+
+        pthread_mutex_lock(&blk->_mutex);
+        blk->_busy = false;
+        pthread_mutex_unlock(&blk->_mutex);
+        pthread_cond_broadcast(&blk->_cond);
     }
 
     return NULL;
@@ -377,6 +436,16 @@ virtio_blk_handle_request(virtio_dev_t *vdev, vq_request_t *req)
 {
     virtio_blk_t *blk = (virtio_blk_t *) vdev;
 
+    int64_t now_ns = get_clock();
+
+    timeline_instant("blk submit", "desc", req->index);
+
+    /* Completion timing of the worker is not reproducible */
+    if (replay_mode != REPLAY_NONE) {
+        blk->start_ns = now_ns;
+        return _do_request(blk, req);
+    }
+
     pthread_mutex_lock(&blk->_mutex);
 
     while (blk->_req) {
@@ -395,6 +464,7 @@ virtio_blk_handle_request(virtio_dev_t *vdev, vq_request_t *req)
         */
 
     blk->_req = req;
+    blk->submit_ns = now_ns;
 
     pthread_mutex_unlock(&blk->_mutex);
     pthread_cond_signal(&blk->_cond);
@@ -402,10 +472,83 @@ virtio_blk_handle_request(virtio_dev_t *vdev, vq_request_t *req)
     return 0;
 }
 
+static void
+virtio_blk_release(virtio_dev_t *vdev)
+{
+    virtio_blk_t *blk = (virtio_blk_t *) vdev;
+
+    pthread_mutex_lock(&blk->_mutex);
+    blk->exiting = true;
+    pthread_mutex_unlock(&blk->_mutex);
+    pthread_cond_signal(&blk->_cond);
+
+    pthread_join(blk->tid, NULL);
+
+    pthread_mutex_destroy(&blk->_mutex);
+    pthread_cond_destroy(&blk->_cond);
+    free(blk->vdev.vq);
+    free(blk);
+}
+
+/*
+ * A request popped from the avail ring is in no saved section until it
+ * lands in the used ring, so let the worker finish it first.
+ */
+static void
+_blk_pre_save(void *opaque)
+{
+    virtio_blk_t *blk = opaque;
+
+    pthread_mutex_lock(&blk->_mutex);
+    while (blk->_req || blk->_busy)
+        pthread_cond_wait(&blk->_cond, &blk->_mutex);
+    pthread_mutex_unlock(&blk->_mutex);
+}
+
+static const snapshot_ops blk_ops = {
+    .pre_save = _blk_pre_save,
+};
+
+static void
+_write_metrics(FILE *out, void *opaque)
+{
+    uint32_t i;
+    uint64_t count = 0;
+    virtio_blk_t *blk = opaque;
+
+    fprintf(out, "# HELP xemu_blk_requests_total "
+            "Completed virtio-blk requests, rate() gives IOPS.\n"
+            "# TYPE xemu_blk_requests_total counter\n");
+    for (i = 0; i < BLK_OP_MAX; i++)
+        fprintf(out, "xemu_blk_requests_total{op=\"%s\"} %lu\n",
+                blk_op_names[i], blk->ops[i]);
+
+    fprintf(out, "# HELP xemu_blk_bytes_total Bytes read and written.\n"
+            "# TYPE xemu_blk_bytes_total counter\n");
+    for (i = 0; i < BLK_OP_FLUSH; i++)
+        fprintf(out, "xemu_blk_bytes_total{op=\"%s\"} %lu\n",
+                blk_op_names[i], blk->bytes[i]);
+
+    fprintf(out, "# HELP xemu_blk_latency_seconds "
+            "From the guest notify to completion.\n"
+            "# TYPE xemu_blk_latency_seconds histogram\n");
+    for (i = 0; i < BLK_LATENCY_BUCKETS; i++) {
+        count += blk->latency[i];
+        if (i < BLK_LATENCY_BUCKETS - 1)
+            fprintf(out, "xemu_blk_latency_seconds_bucket{le=\"%g\"} %lu\n",
+                    (double)(1UL << i) * 1e-6, count);
+        else
+            fprintf(out, "xemu_blk_latency_seconds_bucket{le=\"+Inf\"} %lu\n",
+                    count);
+    }
+    fprintf(out, "xemu_blk_latency_seconds_sum %.9f\n"
+            "xemu_blk_latency_seconds_count %lu\n",
+            (double)blk->latency_ns * 1e-9, count);
+}
+
 virtio_dev_t *
 virtio_blk_init(const char *filename, uint32_t irq_num)
 {
-    pthread_t tid;
     virtio_blk_t *blk;
 
     blk = calloc(1, sizeof(virtio_blk_t));
@@ -420,6 +563,7 @@ virtio_blk_init(const char *filename, uint32_t irq_num)
     blk->vdev.config_writeb = virtio_blk_config_writeb;
 
     blk->vdev.handle_request = virtio_blk_handle_request;
+    blk->vdev.release = virtio_blk_release;
 
     virtio_blk_init_config(blk);
 
@@ -429,7 +573,15 @@ virtio_blk_init(const char *filename, uint32_t irq_num)
     pthread_mutex_init(&blk->_mutex, NULL);
     pthread_cond_init(&blk->_cond, NULL);
 
-    pthread_create(&tid, NULL, _routine, blk);
+    /* Features and status, then the queue. Config is rebuilt above. */
+    snapshot_register("virtio_blk", &blk->vdev,
+                      offsetof(virtio_dev_t, vq), &blk_ops, blk);
+    snapshot_register("virtio_blk.vq", blk->vdev.vq,
+                      sizeof(vqueue_t), NULL, NULL);
+
+    machine_thread_create(&blk->tid, "virtio-blk", _routine, blk);
+
+    metrics_register(_write_metrics, blk);
 
     return (virtio_dev_t *) blk;
 }
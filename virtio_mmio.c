@@ -155,6 +155,17 @@ virtio_mmio_write(void *dev, uint64_t addr, uint64_t data, size_t size,
     return 0;
 }
 
+static void
+virtio_mmio_release(device_t *dev)
+{
+    virtio_mmio_t *virtio_mmio = (virtio_mmio_t *) dev;
+
+    if (virtio_mmio->backend && virtio_mmio->backend->release)
+        virtio_mmio->backend->release(virtio_mmio->backend);
+
+    free(virtio_mmio);
+}
+
 device_t *
 virtio_mmio_init(address_space *parent_as, uint64_t start, uint64_t end)
 {
@@ -162,6 +173,7 @@ virtio_mmio_init(address_space *parent_as, uint64_t start, uint64_t end)
 
     virtio_mmio = calloc(1, sizeof(virtio_mmio_t));
     virtio_mmio->dev.name = "virtio_mmio";
+    virtio_mmio->dev.release = virtio_mmio_release;
 
     init_address_space(&(virtio_mmio->dev.as), start, end);
 
@@ -3,160 +3,387 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
 
-#include "address_space.h"
-#include "isa.h"
-#include "operation.h"
-#include "decode.h"
 #include "util.h"
-#include "device.h"
-#include "execute.h"
-#include "csr.h"
-#include "mmu.h"
-#include "trap.h"
+#include "machine.h"
+#include "control.h"
+#include "coverage.h"
+#include "replay.h"
 #include "system_map.h"
-#include "virtio.h"
-#include "trace.h"
-
-#define DISABLE_TRACE
-
-#define VIRTIO_MMIO_AS_START_0  0x0000000010001000UL
-#define VIRTIO_MMIO_AS_END_0    0x0000000010001FFFUL
+#include "timeline.h"
+#include "metrics.h"
+#include "bios/bios.h"
+
+static machine_config config;
+static const char *control_path;
+static const char *metrics_path;
+static replay_mode_t replay_mode_opt;
+static const char *replay_filename;
+static uint64_t max_insns;
+static uint32_t timeout_secs;
+static const char *timeline_file;
+
+enum {
+    OPT_FIRMWARE = 0x100,
+    OPT_KERNEL,
+    OPT_KERNEL_ADDR,
+    OPT_DRIVE,
+    OPT_HUGEPAGES,
+    OPT_MEM_PATH,
+    OPT_MEM_SHARED,
+    OPT_CONTROL,
+    OPT_METRICS,
+    OPT_RESTORE,
+    OPT_RESTORE_LAZY,
+    OPT_RECORD,
+    OPT_REPLAY,
+    OPT_MAX_INSNS,
+    OPT_TIMEOUT,
+    OPT_HEADLESS,
+    OPT_CONSOLE,
+    OPT_PROFILE,
+    OPT_PROFILE_PERIOD,
+    OPT_SYMBOLS,
+    OPT_STATS,
+    OPT_TRACE,
+    OPT_TRACE_POINTS,
+    OPT_TIMELINE,
+    OPT_IRQ_LATENCY,
+    OPT_HEATMAP,
+    OPT_BOOT_REPORT,
+};
+
+static const struct option long_options[] = {
+    {"memory",      required_argument, NULL, 'm'},
+    {"hugepages",   no_argument,       NULL, OPT_HUGEPAGES},
+    {"mem-path",    required_argument, NULL, OPT_MEM_PATH},
+    {"mem-shared",  no_argument,       NULL, OPT_MEM_SHARED},
+    {"control",     required_argument, NULL, OPT_CONTROL},
+    {"metrics",     required_argument, NULL, OPT_METRICS},
+    {"restore",     required_argument, NULL, OPT_RESTORE},
+    {"restore-lazy", required_argument, NULL, OPT_RESTORE_LAZY},
+    {"record",      required_argument, NULL, OPT_RECORD},
+    {"replay",      required_argument, NULL, OPT_REPLAY},
+    {"max-insns",   required_argument, NULL, OPT_MAX_INSNS},
+    {"timeout",     required_argument, NULL, OPT_TIMEOUT},
+    {"headless",    no_argument,       NULL, OPT_HEADLESS},
+    {"console",     required_argument, NULL, OPT_CONSOLE},
+    {"profile",     required_argument, NULL, OPT_PROFILE},
+    {"profile-period", required_argument, NULL, OPT_PROFILE_PERIOD},
+    {"symbols",     required_argument, NULL, OPT_SYMBOLS},
+    {"stats",       required_argument, NULL, OPT_STATS},
+    {"trace",       required_argument, NULL, OPT_TRACE},
+    {"trace-points", no_argument,      NULL, OPT_TRACE_POINTS},
+    {"timeline",    required_argument, NULL, OPT_TIMELINE},
+    {"irq-latency", required_argument, NULL, OPT_IRQ_LATENCY},
+    {"heatmap",     required_argument, NULL, OPT_HEATMAP},
+    {"boot-report", required_argument, NULL, OPT_BOOT_REPORT},
+    {"direct-boot", no_argument,       NULL, 'd'},
+    {"firmware",    required_argument, NULL, OPT_FIRMWARE},
+    {"kernel",      required_argument, NULL, OPT_KERNEL},
+    {"kernel-addr", required_argument, NULL, OPT_KERNEL_ADDR},
+    {"drive",       required_argument, NULL, OPT_DRIVE},
+    {"help",        no_argument,       NULL, 'h'},
+    {NULL, 0, NULL, 0}
+};
+
+static void
+usage(const char *name)
+{
+    printf("Usage: %s [options] [startpoint]\n"
+           "  -m, --memory SIZE      guest ram size, e.g. 512M, 16G\n"
+           "                         (default: 2G)\n"
+           "  --hugepages            back guest ram with hugetlb pages,\n"
+           "                         not with --mem-path\n"
+           "  --mem-path PATH        share guest ram through file PATH,\n"
+           "                         or a temporary file if PATH is a dir\n"
+           "  --mem-shared           share guest ram through a memfd\n"
+           "  --control PATH         listen for commands on unix socket\n"
+           "  --metrics PATH         serve Prometheus metrics on unix\n"
+           "                         socket, plain or over http\n"
+           "  --restore FILE         start from snapshot FILE, see 'save'\n"
+           "                         on the control socket\n"
+           "  --restore-lazy FILE    as --restore, but fill ram pages on\n"
+           "                         first touch (userfaultfd)\n"
+           "  --record FILE          log non-deterministic inputs to FILE\n"
+           "  --replay FILE          run again with the inputs from FILE;\n"
+           "                         start from the same images and a copy\n"
+           "                         of the disk as it was when recorded\n"
+           "  --max-insns N          stop after N instructions\n"
+           "  --timeout SECS         stop after SECS seconds of wall time\n"
+           "  --headless             do not read stdin for the console\n"
+           "  --console FILE         write console output to FILE\n"
+           "  --profile FILE         sample guest call stacks, write them\n"
+           "                         to FILE as folded stacks\n"
+           "  --profile-period N[us] sample every N instructions, or N\n"
+           "                         host microseconds (default: 10000)\n"
+           "  --symbols FILE         more symbols in System.map format,\n"
+           "                         e.g. for modules\n"
+           "  --stats FILE|-         count the instruction mix, accesses\n"
+           "                         and traps; append them to FILE on\n"
+           "                         exit and on SIGUSR1\n"
+           "  --trace FILE           write a binary trace of every\n"
+           "                         instruction, see tools/xemu-trace\n"
+           "  --trace-points         start with conf/trace.yml points on;\n"
+           "                         SIGUSR2 or 'trace' on the control\n"
+           "                         socket turns them on and off\n"
+           "  --timeline FILE        write device, interrupt and trap\n"
+           "                         events as Chrome trace JSON\n"
+           "  --irq-latency FILE|-   histograms of interrupt assert to\n"
+           "                         trap, appended to FILE on exit\n"
+           "  --heatmap FILE         count fetches, loads and stores per\n"
+           "                         physical page; write FILE on exit\n"
+           "                         and at every ROI end\n"
+           "  --boot-report FILE|-   time and instructions between boot\n"
+           "                         milestones, appended to FILE on exit\n"
+           "  -d, --direct-boot      load firmware and kernel into ram\n"
+           "                         directly instead of running bios.bin\n"
+           "  --firmware FILE|none   firmware for direct boot\n"
+           "                         (default: image/fw_jump.bin)\n"
+           "  --kernel FILE          kernel for direct boot, ELF or flat\n"
+           "                         (default: image/startup.bin)\n"
+           "  --kernel-addr ADDR     load address of a flat kernel\n"
+           "                         (default: 0x%x)\n"
+           "  --drive FILE|none      raw disk image for virtio-blk\n"
+           "                         (default: image/test.raw)\n"
+           "  -h, --help             show this message\n"
+           "\n"
+           "Exit status: 0 on guest poweroff or --max-insns, the guest's\n"
+           "code (1 if zero) when it reports failure through the test\n"
+           "device, %d on --timeout.\n",
+           name, PAYLOAD_LINK_ADDR, MACHINE_STATUS_TIMEOUT);
+}
 
-extern address_space root_as;
+static void
+parse_args(int argc, char **argv)
+{
+    int c;
+
+    while ((c = getopt_long(argc, argv, "m:dh", long_options, NULL)) != -1) {
+        switch (c)
+        {
+        case 'm':
+            config.mem_size = parse_size(optarg);
+            break;
+        case OPT_HUGEPAGES:
+            config.ram_flags |= RAM_F_HUGETLB;
+            break;
+        case OPT_MEM_PATH:
+            config.mem_path = optarg;
+            break;
+        case OPT_MEM_SHARED:
+            config.ram_flags |= RAM_F_SHARED;
+            break;
+        case OPT_CONTROL:
+            control_path = optarg;
+            break;
+        case OPT_METRICS:
+            metrics_path = optarg;
+            break;
+        case OPT_RESTORE:
+            config.snapshot = optarg;
+            break;
+        case OPT_RESTORE_LAZY:
+            config.snapshot = optarg;
+            config.snapshot_lazy = true;
+            break;
+        case OPT_RECORD:
+            replay_mode_opt = REPLAY_RECORD;
+            replay_filename = optarg;
+            break;
+        case OPT_REPLAY:
+            replay_mode_opt = REPLAY_PLAY;
+            replay_filename = optarg;
+            break;
+        case OPT_MAX_INSNS:
+            max_insns = strtoul(optarg, NULL, 0);
+            break;
+        case OPT_TIMEOUT:
+            timeout_secs = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case OPT_HEADLESS:
+            config.uart_input = false;
+            break;
+        case OPT_CONSOLE:
+            config.console = optarg;
+            break;
+        case OPT_PROFILE:
+            config.profile = optarg;
+            break;
+        case OPT_PROFILE_PERIOD: {
+            char *end;
+            config.profile_period = strtoul(optarg, &end, 0);
+            config.profile_host_time = streq(end, "us");
+            break;
+        }
+        case OPT_SYMBOLS:
+            add_system_map(optarg);
+            break;
+        case OPT_STATS:
+            config.stats = optarg;
+            break;
+        case OPT_TRACE:
+            config.trace = optarg;
+            break;
+        case OPT_TRACE_POINTS:
+            config.trace_points = true;
+            break;
+        case OPT_TIMELINE:
+            timeline_file = optarg;
+            break;
+        case OPT_IRQ_LATENCY:
+            config.irq_latency = optarg;
+            break;
+        case OPT_HEATMAP:
+            config.heatmap = optarg;
+            break;
+        case OPT_BOOT_REPORT:
+            config.boot_report = optarg;
+            break;
+        case 'd':
+            config.direct_boot = true;
+            break;
+        case OPT_FIRMWARE:
+            config.direct_boot = true;
+            config.firmware = streq(optarg, "none") ? NULL : optarg;
+            break;
+        case OPT_KERNEL:
+            config.direct_boot = true;
+            config.kernel = optarg;
+            break;
+        case OPT_KERNEL_ADDR:
+            config.direct_boot = true;
+            config.kernel_addr = strtoul(optarg, NULL, 0);
+            break;
+        case OPT_DRIVE:
+            config.drive = streq(optarg, "none") ? NULL : optarg;
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(0);
+        default:
+            usage(argv[0]);
+            exit(-1);
+        }
+    }
 
-const char *_startpoint = NULL;
+    if (optind < argc)
+        config.startpoint = argv[optind];
+}
 
-uint64_t _pc = 0x1000;
-const char *vda_filename = "./image/test.raw";
+/* Machine the watchdog stops, NULL between reboots */
+static pthread_mutex_t current_mutex = PTHREAD_MUTEX_INITIALIZER;
+static machine_t *current;
+static bool timed_out;
 
-uint64_t
-fetch(address_space *as, uint32_t *inst)
+static void
+set_current(machine_t *m)
 {
-    uint32_t lo;
-    uint32_t hi;
-
-    bool has_except = false;
-
-    if ((_pc + 2) & (PAGE_SIZE - 1UL)) {
-        *inst = (uint32_t)as_read(as, _pc, 4, 0, &has_except);
-        if (has_except)
-            return raise_except(_pc, CAUSE_INST_PAGE_FAULT, _pc);
+    pthread_mutex_lock(&current_mutex);
+    current = m;
+    pthread_mutex_unlock(&current_mutex);
+}
 
-        return 0;
-    }
+static void *
+watchdog(void *opaque)
+{
+    struct timespec ts = { .tv_sec = timeout_secs };
 
-    lo = (uint32_t)as_read(as, _pc, 2, 0, &has_except);
-    if (has_except)
-        return raise_except(_pc, CAUSE_INST_PAGE_FAULT, _pc);
+    while (nanosleep(&ts, &ts))
+        ;
 
-    hi = (uint32_t)as_read(as, _pc + 2, 2, 0, &has_except);
-    if (has_except)
-        return raise_except(_pc, CAUSE_INST_PAGE_FAULT, (_pc + 2));
+    pthread_mutex_lock(&current_mutex);
+    timed_out = true;
+    if (current)
+        machine_finish(current, MACHINE_EXIT_TIMEOUT, 0);
+    pthread_mutex_unlock(&current_mutex);
 
-    *inst = ((hi << 16) | lo);
-    return 0;
+    return NULL;
 }
 
 int
 main(int argc, char **argv)
 {
-    uint64_t i;
-    device_t *rom;
-    device_t *flash;
+    machine_t *m;
+    pthread_t tid;
+    int64_t start;
+    double secs;
+    uint64_t insns = 0;
+    machine_exit_t reason;
+    uint32_t code;
 
-    if (argc > 1)
-        _startpoint = argv[1];
+    machine_config_init(&config);
+    config.drive = "./image/test.raw";
+    config.uart_input = true;
+
+    parse_args(argc, argv);
 
     printf("[XEMU startup ...]\n");
 
-    setup_system_map();
-    setup_trace_table();
+    /* Before devices, they check the mode when starting threads */
+    replay_init(replay_mode_opt, replay_filename);
 
-    /* Init root address space */
-    init_address_space(&root_as,
-                       ROOT_ADDRESS_SPACE_START,
-                       ROOT_ADDRESS_SPACE_END);
+    coverage_init();
 
-    /* Init CSR */
-    csr_init();
+    /* Covers all machines, across guest reboots */
+    timeline_init(timeline_file);
 
-    cpu_enable_clock();
+    /* Before the machine, so that its devices add their commands */
+    if (control_path)
+        control_init(control_path);
 
-    rtc_init(&root_as);
-    pci_host_init(&root_as);
+    if (metrics_path)
+        metrics_init(metrics_path);
 
-    plic_init(&root_as);
-    clint_init(&root_as);
+    if (timeout_secs)
+        pthread_create(&tid, NULL, watchdog, NULL);
 
-    rom = rom_init(&root_as);
-    rom_add_file(rom, "image/bios.bin", 0);
-    rom_add_file(rom, "image/virt.dtb", 0x100);
-    rom_add_file(rom, "image/fw_jump.bin", 0x2000);
+    start = get_clock();
 
-    flash = flash_init(&root_as);
-    flash_load_modules(flash);
+    /* A guest reboot starts over with a new machine */
+    for (;;) {
+        m = machine_create(&config);
+        set_current(m);
 
-    ram_init(&root_as);
+        if (timed_out) {
+            reason = MACHINE_EXIT_TIMEOUT;
+            code = 0;
+        } else {
+            insns += machine_run(m, max_insns ? max_insns - insns : 0);
+            reason = m->exit_reason;
+            code = m->exit_code;
+        }
 
-    uart_init(&root_as, 0xa);
+        set_current(NULL);
+        machine_destroy(m);
 
-    for (i = 0; i < 8; i++) {
-        device_t *vdev;
-        vdev = virtio_mmio_init(&root_as,
-                                VIRTIO_MMIO_AS_START_0 + i * 0x1000,
-                                VIRTIO_MMIO_AS_END_0 + i * 0x1000);
+        if (reason != MACHINE_EXIT_RESET)
+            break;
 
-        if (i == 0) {
-            virtio_dev_t *blk = virtio_blk_init(vda_filename, i + 1);
-            virtio_set_backend(vdev, blk);
+        if (max_insns && insns >= max_insns) {
+            reason = MACHINE_EXIT_LIMIT;
+            break;
         }
-    }
 
-    while (1) {
-        op_t      op;
-        uint32_t  rd;
-        uint32_t  rs1;
-        uint32_t  rs2;
-        uint64_t  imm;
-        uint32_t  csr_addr;
-        uint32_t  opcode;
-
-        uint64_t next_pc = 0;
-        uint32_t inst = 0;
-
-        if (_pc < 0x1000)
-            panic("%s: bad pc 0x%lx\n", __func__, _pc);
-
-        next_pc = handle_interrupt(_pc);
-        if (next_pc) {
-            /* An interrupt occurs */
-            _pc = next_pc;
-            continue;
+        if (replay_mode != REPLAY_NONE) {
+            printf("%s: no reboot while recording or replaying\n", __func__);
+            break;
         }
 
-        /* Fetch */
-        next_pc = fetch(&root_as, &inst);
-        if (next_pc) {
-            /* An except occurs during fetch */
-            _pc = next_pc;
-            continue;
-        }
-
-        /* Decode */
-        next_pc = decode(_pc, inst, &op, &rd, &rs1, &rs2, &imm,
-                         &csr_addr, &opcode);
-
-        /* Execute */
-        next_pc = execute(&root_as, _pc, next_pc,
-                          op, rd, rs1, rs2, imm, csr_addr);
+        printf("[XEMU reboot ...]\n");
+    }
 
-#ifndef DISABLE_TRACE
-        trace(_pc, op, rd, rs1, rs2, imm, csr_addr, opcode, inst);
-#endif
+    secs = (double)(get_clock() - start) / 1e9;
 
-        _pc = next_pc;
-    }
+    timeline_exit();
+    fprintf(stderr, "xemu: %s (status %d): %lu insns in %.3fs, %.2f MIPS\n",
+            machine_exit_name(reason), machine_exit_status(reason, code),
+            insns, secs, secs > 0 ? (double)insns / secs / 1e6 : 0.0);
 
-    return 0;
+    return machine_exit_status(reason, code);
 }
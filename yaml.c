@@ -6,12 +6,11 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "util.h"
 #include "yaml.h"
 
 #define TRACE_FILE_IN_YAML  "./conf/trace.yml"
 
-static void
+static int
 parse_line(const char *line, parse_cb cb)
 {
     const char *begin;
@@ -20,52 +19,61 @@ parse_line(const char *line, parse_cb cb)
     char value[256] = {0};
 
     if (line == NULL)
-        return;
+        return 0;
 
     begin = line;
     while (*begin == ' ')
         begin++;
 
     if (*begin == 0 || *begin == '#')
-        return;
+        return 0;
 
     end = strchr(begin, ':');
     if (end == NULL)
-        return;
+        return 0;
 
     strncpy(name, begin, (size_t)(end - begin));
 
     begin = end + 1;
-    if (*begin == '\n') {
-        cb(TOKEN_OBJ, name, "");
-        return;
-    }
+    if (*begin == '\n')
+        return cb(TOKEN_OBJ, name, "");
 
     if (*begin != ' ')
-        panic("%s: bad line %s in yaml\n", __func__, line);
+        return -1;
 
     /* Skip space that followed ':' */
     begin++;
     end = strchr(begin, '\n');
+    if (end == NULL)
+        end = begin + strlen(begin);
     strncpy(value, begin, (size_t)(end - begin));
-    cb(TOKEN_KV, name, value);
+    return cb(TOKEN_KV, name, value);
 }
 
-void
-parse_yaml(parse_cb cb)
+int
+parse_yaml(parse_cb cb, char *err, size_t size)
 {
     FILE *fp;
     char line[256];
+    uint32_t n = 0;
 
     fp = fopen(TRACE_FILE_IN_YAML, "r");
     if (fp == NULL) {
-        panic("%s: bad trace config file %s\n",
-              __func__, TRACE_FILE_IN_YAML);
-        return;
+        snprintf(err, size, "cannot open %s", TRACE_FILE_IN_YAML);
+        return -1;
     }
 
-    while (fgets(line, sizeof(line), fp) != NULL)
-        parse_line(line, cb);
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        n++;
+        if (parse_line(line, cb)) {
+            line[strcspn(line, "\n")] = '\0';
+            snprintf(err, size, "%s:%u: bad line '%s'",
+                     TRACE_FILE_IN_YAML, n, line);
+            fclose(fp);
+            return -1;
+        }
+    }
 
     fclose(fp);
+    return 0;
 }
@@ -13,9 +13,13 @@ typedef enum _TOKEN {
     TOKEN_KV,
 } TOKEN;
 
+#include <stddef.h>
+
+/* Nonzero rejects the line */
 typedef int (*parse_cb)(TOKEN token, const char *key, const char *value);
 
-void
-parse_yaml(parse_cb cb);
+/* 0 on success, else -1 with the file and line that failed in @err */
+int
+parse_yaml(parse_cb cb, char *err, size_t size);
 
 #endif /* _YAML_H_ */